@@ -0,0 +1,277 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/*
+ * Contador de alocações do processo. Compilado com ALLOC_TRACKING (opção
+ * ALLOC_TRACKING do CMake, ligada sempre no micro_bench), este header substitui
+ * malloc, calloc, realloc, free e as variantes alinhadas do executável, repassando
+ * às implementações da glibc; o operator new padrão da libstdc++ aloca via malloc e
+ * também é contado. Deve ser incluído por um único arquivo de cada executável.
+ *
+ * Sem ALLOC_TRACKING nada é substituído, para não conflitar com sanitizers nem com
+ * alocadores carregados por LD_PRELOAD, e os contadores ficam zerados. Com ele, a
+ * contagem fica desligada até UDP_AUTH_ALLOC ser definida (ou allocationTracking ser
+ * ligada pelo programa); desligada, o custo é um teste por alocação
+ */
+
+#ifdef ALLOC_TRACKING
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void  __libc_free(void* ptr);
+}
+#endif // ALLOC_TRACKING
+
+const char ALLOC_ENV[] = "UDP_AUTH_ALLOC";
+
+class AllocationCounters
+{
+    public:
+        uint64_t allocations = 0;
+        uint64_t bytes       = 0; // bytes pedidos, não os reservados pela glibc
+        uint64_t frees       = 0;
+};
+
+// Lida antes de qualquer inicialização dinâmica: começa falsa e é ligada logo que
+// o inicializador estático roda
+bool allocationTracking = []() {
+    const char* value     = std::getenv(ALLOC_ENV);
+    bool        requested = value && *value && *value != '0';
+
+#ifndef ALLOC_TRACKING
+    if (requested)
+    {
+        std::fprintf(stderr,
+                     "Aviso: %s ignorada; compile com -DALLOC_TRACKING=ON\n",
+                     ALLOC_ENV);
+    }
+    return false;
+#else
+    return requested;
+#endif
+}();
+
+// Contadores por thread, sem sincronização no caminho da alocação
+thread_local AllocationCounters threadAllocations;
+
+inline void countAllocation(size_t size)
+{
+    if (allocationTracking)
+    {
+        threadAllocations.allocations++;
+        threadAllocations.bytes += size;
+    }
+}
+
+#ifdef ALLOC_TRACKING
+extern "C"
+{
+    void* malloc(size_t size)
+    {
+        countAllocation(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        countAllocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        countAllocation(size);
+        return __libc_realloc(ptr, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        countAllocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** ptr, size_t alignment, size_t size)
+    {
+        if (alignment % sizeof(void*) || alignment & (alignment - 1))
+            return EINVAL;
+
+        countAllocation(size);
+        *ptr = __libc_memalign(alignment, size);
+        return *ptr ? 0 : ENOMEM;
+    }
+
+    void free(void* ptr)
+    {
+        if (ptr && allocationTracking)
+            threadAllocations.frees++;
+
+        __libc_free(ptr);
+    }
+}
+#endif // ALLOC_TRACKING
+
+/**
+ * @brief Zera o pico de memória residente do processo (VmHWM), para que o pico lido
+ *        depois seja o do comando atual e não o de toda a vida do processo
+ * @return false se o kernel não permite o reset; o pico é então o do processo
+ */
+bool resetPeakRss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool reset = write(fd, "5", 1) == 1;
+    close(fd);
+
+    return reset;
+}
+
+// VmHWM de /proc/self/status, ou ru_maxrss quando ele não está disponível
+long peakRssKb()
+{
+    FILE* status = std::fopen("/proc/self/status", "re");
+    long  peak   = -1;
+
+    if (status)
+    {
+        char line[128];
+        while (peak < 0 && std::fgets(line, sizeof(line), status))
+        {
+            if (std::strncmp(line, "VmHWM:", 6) == 0)
+                peak = std::strtol(line + 6, nullptr, 10);
+        }
+        std::fclose(status);
+    }
+
+    if (peak < 0)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+
+    return peak;
+}
+
+/**
+ * @brief Contadores da thread atual e pico de memória residente
+ */
+class AllocationSnapshot
+{
+    public:
+        AllocationCounters counters;
+        long               peakRssKb      = 0;
+        bool               peakPerCommand = false;
+
+        static AllocationSnapshot take()
+        {
+            return { threadAllocations, ::peakRssKb() };
+        }
+
+        // Início de um comando: zera também o pico de memória residente
+        static AllocationSnapshot begin()
+        {
+            bool reset = resetPeakRss();
+            return { threadAllocations, ::peakRssKb(), reset };
+        }
+};
+
+class AllocationStats
+{
+    public:
+        const char* name;
+        uint64_t    operations     = 0;
+        uint64_t    allocations    = 0;
+        uint64_t    bytes          = 0;
+        uint64_t    minAllocations = UINT64_MAX;
+        uint64_t    maxAllocations = 0;
+        long        peakRssKb      = 0; // maior pico entre os comandos
+};
+
+/**
+ * @brief Alocações por operação (itr, itv, gtr, gtv, gtp), agregadas por comando
+ */
+class AllocationProfile
+{
+    public:
+        AllocationStats operations[5] = {
+            { "itr" }, { "itv" }, { "gtr" }, { "gtv" }, { "gtp" }
+        };
+        bool peakPerCommand = true;
+
+        // Registra as alocações da thread atual desde before
+        void record(const char* name, const AllocationSnapshot& before)
+        {
+            AllocationSnapshot after = AllocationSnapshot::take();
+
+            for (AllocationStats& stats : operations)
+            {
+                if (std::strcmp(stats.name, name) != 0)
+                    continue;
+
+                uint64_t allocations =
+                    after.counters.allocations - before.counters.allocations;
+
+                stats.operations++;
+                stats.allocations += allocations;
+                stats.bytes += after.counters.bytes - before.counters.bytes;
+                stats.minAllocations = std::min(stats.minAllocations, allocations);
+                stats.maxAllocations = std::max(stats.maxAllocations, allocations);
+                stats.peakRssKb      = std::max(stats.peakRssKb, after.peakRssKb);
+            }
+
+            peakPerCommand = peakPerCommand && before.peakPerCommand;
+        }
+
+        void report(std::ostream& os) const
+        {
+            // Sem o reset do VmHWM o pico é o da vida toda do processo
+            os << std::left << std::setw(6) << "op" << std::right << std::setw(8)
+               << "count" << std::setw(12) << "allocs/op" << std::setw(12)
+               << "min allocs" << std::setw(12) << "max allocs" << std::setw(12)
+               << "bytes/op" << std::setw(14)
+               << (peakPerCommand ? "peak RSS KiB" : "proc peak KiB") << std::endl;
+
+            os << std::fixed << std::setprecision(1);
+            for (const AllocationStats& stats : operations)
+            {
+                if (!stats.operations)
+                    continue;
+
+                os << std::left << std::setw(6) << stats.name << std::right
+                   << std::setw(8) << stats.operations << std::setw(12)
+                   << static_cast<double>(stats.allocations) / stats.operations
+                   << std::setw(12) << stats.minAllocations << std::setw(12)
+                   << stats.maxAllocations << std::setw(12)
+                   << static_cast<double>(stats.bytes) / stats.operations
+                   << std::setw(14) << stats.peakRssKb << std::endl;
+            }
+            os << std::defaultfloat;
+        }
+};
+
+AllocationProfile& allocationProfile()
+{
+    static AllocationProfile profile;
+    return profile;
+}
+
+#endif // ALLOC_H
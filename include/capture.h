@@ -0,0 +1,227 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+const char     CAPTURE_ENV[]    = "UDP_AUTH_CAPTURE";
+const char     CAPTURE_MAGIC[4] = { 'U', 'A', 'C', 'P' };
+const uint16_t CAPTURE_VERSION  = 1;
+
+enum CaptureDirection : uint8_t
+{
+    CAPTURE_SENT     = 0,
+    CAPTURE_RECEIVED = 1
+};
+
+/* Cabeçalho do arquivo de captura
+
+    0                   4         6         8
+    +----+----+----+----+----+----+----+----+
+    | "UACP"            | version | 0       |
+    +----+----+----+----+----+----+----+----+
+*/
+class CaptureFileHeader
+{
+    public:
+        char     magic[4];
+        uint16_t version;
+        uint16_t reserved;
+
+        CaptureFileHeader()
+            : version(CAPTURE_VERSION),
+              reserved(0)
+        {
+            std::memcpy(magic, CAPTURE_MAGIC, sizeof(magic));
+        }
+} __attribute__((packed));
+
+/* Registro de um datagrama (ordem de bytes do host), seguido de length bytes
+
+    0                   8         12     14    15    16      18
+    +----/      /-------+---------+------+-----+-----+-------+---/   /---+
+    | timestamp (ns)    | session | chan | dir | 0   | length | payload  |
+    +----/      /-------+---------+------+-----+-----+-------+---/   /---+
+*/
+class CaptureRecord
+{
+    public:
+        uint64_t timestamp;
+        uint32_t session;
+        uint16_t channel;
+        uint8_t  direction;
+        uint8_t  reserved;
+        uint16_t length;
+} __attribute__((packed));
+
+class CapturedDatagram
+{
+    public:
+        CaptureRecord     record;
+        std::vector<char> payload;
+};
+
+uint64_t captureTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+class CaptureWriter
+{
+    public:
+        CaptureWriter(const char* path)
+            : session(static_cast<uint32_t>(getpid()))
+        {
+            // O_APPEND permite que várias execuções do cliente compartilhem o arquivo
+            fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0)
+            {
+                perror("Erro ao abrir arquivo de captura");
+                return;
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size == 0)
+            {
+                CaptureFileHeader header;
+                if (write(fd, &header, sizeof(header)) < 0)
+                {
+                    perror("Erro ao escrever arquivo de captura");
+                }
+            }
+        }
+
+        ~CaptureWriter()
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+
+        bool isOpen() const
+        {
+            return fd >= 0;
+        }
+
+        void record(CaptureDirection direction,
+                    uint16_t         channel,
+                    const void*      data,
+                    size_t           size)
+        {
+            if (fd < 0)
+                return;
+
+            CaptureRecord header;
+            header.timestamp = captureTimestamp();
+            header.session   = session;
+            header.channel   = channel;
+            header.direction = direction;
+            header.reserved  = 0;
+            header.length =
+                static_cast<uint16_t>(std::min<size_t>(size, UINT16_MAX));
+
+            // Uma única escrita por registro para que execuções concorrentes não
+            // intercalem cabeçalho e payload
+            struct iovec iov[2];
+            iov[0].iov_base = &header;
+            iov[0].iov_len  = sizeof(header);
+            iov[1].iov_base = const_cast<void*>(data);
+            iov[1].iov_len  = header.length;
+
+            if (writev(fd, iov, 2) < 0)
+            {
+                perror("Erro ao escrever arquivo de captura");
+            }
+        }
+
+    private:
+        int      fd;
+        uint32_t session;
+};
+
+/**
+ * @brief Retorna o writer de captura configurado pela variável UDP_AUTH_CAPTURE, ou
+ *        nullptr quando a captura está desligada
+ */
+CaptureWriter* activeCapture()
+{
+    static CaptureWriter* capture = []() -> CaptureWriter* {
+        const char* path = std::getenv(CAPTURE_ENV);
+
+        if (!path || !*path)
+            return nullptr;
+
+        static CaptureWriter writer(path);
+        return writer.isOpen() ? &writer : nullptr;
+    }();
+
+    return capture;
+}
+
+/**
+ * @brief Lê todos os registros de um arquivo de captura
+ * @return false se o arquivo não existe ou não é uma captura válida
+ */
+bool readCapture(const std::string& path, std::vector<CapturedDatagram>& datagrams)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Erro ao abrir arquivo de captura");
+        return false;
+    }
+
+    std::vector<char> content;
+    char              chunk[1 << 16];
+    ssize_t           len;
+
+    while ((len = read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        content.insert(content.end(), chunk, chunk + len);
+    }
+    close(fd);
+
+    CaptureFileHeader header;
+    if (content.size() < sizeof(header))
+        return false;
+
+    std::memcpy(&header, content.data(), sizeof(header));
+    if (std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CAPTURE_VERSION)
+    {
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    while (offset + sizeof(CaptureRecord) <= content.size())
+    {
+        CapturedDatagram datagram;
+        std::memcpy(&datagram.record, content.data() + offset, sizeof(CaptureRecord));
+        offset += sizeof(CaptureRecord);
+
+        // Registro truncado no fim do arquivo (execução interrompida)
+        if (offset + datagram.record.length > content.size())
+            break;
+
+        datagram.payload.assign(content.data() + offset,
+                                content.data() + offset + datagram.record.length);
+        offset += datagram.record.length;
+
+        datagrams.push_back(std::move(datagram));
+    }
+
+    return true;
+}
+
+#endif // CAPTURE_H
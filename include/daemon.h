@@ -0,0 +1,423 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "writer.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+const char DAEMON_SOCKET_ENV[] = "UDP_AUTH_DAEMON_SOCKET";
+
+/* Requisição enviada ao daemon pelo socket Unix; os descritores de stdout e stderr
+   do cliente seguem como SCM_RIGHTS junto com o cabeçalho, e os argumentos vêm em
+   seguida separados por '\0'. O daemon responde com o status de saída (int32)
+
+    0         4         8        9
+    +----+----+----+----+--------+----/     /----+
+    | argc    | length  | format | argv          |
+    +----+----+----+----+--------+----/     /----+
+*/
+class DaemonRequest
+{
+    public:
+        uint32_t argc;
+        uint32_t length;
+        uint8_t  format;
+} __attribute__((packed));
+
+using CommandRunner = int (*)(int argc, char* argv[]);
+
+/**
+ * @brief Caminho do socket Unix do daemon: UDP_AUTH_DAEMON_SOCKET, ou por padrão
+ *        $XDG_RUNTIME_DIR (privado do usuário) e, sem ele, um caminho por usuário em
+ *        /tmp. Com a variável definida e vazia, o encaminhamento é desligado e o
+ *        caminho retornado é vazio
+ */
+std::string daemonSocketPath()
+{
+    const char* path = std::getenv(DAEMON_SOCKET_ENV);
+
+    if (path)
+        return path;
+
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir)
+        return std::string(runtimeDir) + "/udp_auth_client.sock";
+
+    return "/tmp/udp_auth_client." + std::to_string(getuid()) + ".sock";
+}
+
+/**
+ * @brief Verifica pelo SO_PEERCRED que o outro lado do socket Unix é um processo do
+ *        mesmo usuário: os comandos levam SAS e os descritores do terminal
+ */
+bool peerIsCurrentUser(int fd)
+{
+    struct ucred credentials;
+    socklen_t    length = sizeof(credentials);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0)
+        return false;
+
+    return credentials.uid == getuid();
+}
+
+/**
+ * @brief Verifica que path é um socket do usuário atual sem permissões para grupo e
+ *        outros, como o criado por runDaemon. Em um diretório compartilhado como o
+ *        /tmp, outro usuário poderia ter criado o caminho antes do daemon
+ */
+bool daemonSocketIsTrusted(const std::string& path)
+{
+    struct stat st;
+
+    if (lstat(path.c_str(), &st) < 0)
+        return false;
+
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0077))
+    {
+        std::cerr << "Aviso: ignorando socket de daemon que não pertence ao usuário "
+                     "ou tem permissões abertas: "
+                  << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool fillUnixAddress(const std::string& path, struct sockaddr_un& addr)
+{
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    return true;
+}
+
+bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+            return false;
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+
+    while (size > 0)
+    {
+        ssize_t len = read(fd, bytes, size);
+
+        if (len < 0 && errno == EINTR)
+            continue;
+
+        if (len <= 0)
+            return false;
+
+        bytes += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Tenta executar o comando no daemon. A saída do daemon vai direto para o
+ *        stdout/stderr deste processo
+ * @return false se não há daemon escutando; o comando deve rodar localmente
+ */
+bool forwardToDaemon(const std::string& path, int argc, char* argv[], int& status)
+{
+    struct sockaddr_un addr;
+    if (!fillUnixAddress(path, addr) || !daemonSocketIsTrusted(path))
+        return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // O arquivo pode ter sido trocado entre o lstat e o connect: a credencial do
+    // processo que aceitou a conexão é a verificação que vale
+    if (!peerIsCurrentUser(fd))
+    {
+        std::cerr << "Aviso: daemon em " << path << " pertence a outro usuário"
+                  << std::endl;
+        close(fd);
+        return false;
+    }
+
+    std::string args;
+    for (int i = 0; i < argc; ++i)
+    {
+        args.append(argv[i]);
+        args.push_back('\0');
+    }
+
+    DaemonRequest request;
+    request.argc   = argc;
+    request.length = args.size();
+    request.format = outputFormatFromEnv();
+
+    int           fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    char          control[CMSG_SPACE(sizeof(fds))] = {};
+    struct iovec  iov = { &request, sizeof(request) };
+    struct msghdr msg{};
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level     = SOL_SOCKET;
+    cmsg->cmsg_type      = SCM_RIGHTS;
+    cmsg->cmsg_len       = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t reply;
+    bool    ok = sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(request) &&
+              writeAll(fd, args.data(), args.size()) && readAll(fd, &reply, sizeof(reply));
+    close(fd);
+
+    // Daemon morreu no meio do comando: não há como saber se a saída saiu inteira
+    if (!ok)
+    {
+        std::cerr << "Erro na comunicação com o daemon" << std::endl;
+        status = EXIT_FAILURE;
+        return true;
+    }
+
+    status = reply;
+    return true;
+}
+
+/**
+ * @brief Atende um comando encaminhado: redireciona stdout/stderr para os
+ *        descritores do cliente enquanto o comando roda
+ */
+void serveDaemonConnection(int conn, CommandRunner run, int savedOut, int savedErr)
+{
+    DaemonRequest request;
+    int           fds[2] = { -1, -1 };
+    char          control[CMSG_SPACE(sizeof(fds))];
+    struct iovec  iov = { &request, sizeof(request) };
+    struct msghdr msg{};
+
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(request))
+        return;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return;
+
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    std::vector<char> args(request.length + 1, '\0');
+    std::vector<char*> argv;
+
+    if (readAll(conn, args.data(), request.length))
+    {
+        for (size_t offset = 0; offset < request.length && argv.size() < request.argc;
+             offset += std::strlen(args.data() + offset) + 1)
+        {
+            argv.push_back(args.data() + offset);
+        }
+    }
+
+    int32_t status = EXIT_FAILURE;
+
+    if (argv.size() == request.argc)
+    {
+        argv.push_back(nullptr);
+
+        dup2(fds[0], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        resultWriter().setFormat(static_cast<OutputFormat>(request.format));
+
+        try
+        {
+            status = run(request.argc, argv.data());
+        }
+        catch (const CommandFailure&)
+        {
+            status = EXIT_FAILURE;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            status = EXIT_FAILURE;
+        }
+
+        resultWriter().flush();
+        dup2(savedOut, STDOUT_FILENO);
+        dup2(savedErr, STDERR_FILENO);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    writeAll(conn, &status, sizeof(status));
+}
+
+/**
+ * @brief Remove o socket deixado em path por um daemon que não terminou normalmente.
+ *        Recusa caminhos que não são sockets e sockets em que um daemon ainda atende
+ * @return false se o daemon não deve usar path
+ */
+bool removeStaleDaemonSocket(const std::string& path, const struct sockaddr_un& addr)
+{
+    struct stat st;
+
+    if (lstat(path.c_str(), &st) < 0)
+    {
+        if (errno == ENOENT)
+            return true;
+
+        perror("Erro ao verificar o socket do daemon");
+        return false;
+    }
+
+    if (!S_ISSOCK(st.st_mode))
+    {
+        std::cerr << "Caminho do socket do daemon existe e não é um socket: " << path
+                  << std::endl;
+        return false;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0)
+    {
+        perror("Erro ao criar socket do daemon");
+        return false;
+    }
+
+    bool live = connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    close(probe);
+
+    if (live)
+    {
+        std::cerr << "Já há um daemon escutando em " << path << std::endl;
+        return false;
+    }
+
+    unlink(path.c_str());
+    return true;
+}
+
+/**
+ * @brief Mantém o cliente residente atendendo comandos pelo socket Unix em path.
+ *        Os comandos rodam um por vez e reaproveitam o estado do processo
+ *        (endereços resolvidos e sockets abertos)
+ */
+int runDaemon(const std::string& path, CommandRunner run)
+{
+    struct sockaddr_un addr;
+    if (!fillUnixAddress(path, addr))
+    {
+        std::cerr << "Caminho inválido para o socket do daemon: " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        perror("Erro ao criar socket do daemon");
+        return EXIT_FAILURE;
+    }
+
+    if (!removeStaleDaemonSocket(path, addr))
+    {
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    mode_t mask = umask(0077); // só o próprio usuário pode encaminhar comandos
+
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(listener, SOMAXCONN) < 0)
+    {
+        perror("Erro ao escutar no socket do daemon");
+        umask(mask);
+        close(listener);
+        return EXIT_FAILURE;
+    }
+    umask(mask);
+
+    // Cliente que desiste no meio não pode derrubar o daemon
+    signal(SIGPIPE, SIG_IGN);
+    failureThrows() = true;
+
+    int savedOut = dup(STDOUT_FILENO);
+    int savedErr = dup(STDERR_FILENO);
+
+    std::cerr << "Daemon escutando em " << path << std::endl;
+
+    while (true)
+    {
+        int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            perror("Erro ao aceitar conexão no daemon");
+            break;
+        }
+
+        // A permissão 0700 do socket já barra outros usuários; a credencial cobre
+        // um socket com permissões alteradas depois do bind
+        if (peerIsCurrentUser(conn))
+            serveDaemonConnection(conn, run, savedOut, savedErr);
+        else
+            std::cerr << "Conexão de outro usuário recusada" << std::endl;
+
+        close(conn);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+
+    return EXIT_FAILURE;
+}
+
+#endif // DAEMON_H
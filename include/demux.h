@@ -0,0 +1,297 @@
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include "tokens.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdint.h>
+#include <unordered_map>
+
+const uint16_t ERROR_RESPONSE_TYPE = 256;
+
+enum DemuxStatus
+{
+    DEMUX_OK,
+    DEMUX_TOO_SHORT,
+    DEMUX_UNKNOWN_TYPE,
+    DEMUX_BAD_LENGTH,
+    DEMUX_UNMATCHED
+};
+
+/**
+ * @brief Layout de um tipo de mensagem: o tamanho esperado é base + perItem * N,
+ *        onde N é o campo de 16 bits após o tipo quando counted é verdadeiro
+ */
+class MessageLayout
+{
+    public:
+        uint16_t    type;
+        const char* name;
+        uint16_t    base;
+        uint16_t    perItem;
+        bool        counted;
+        uint16_t    replyTo; // tipo da requisição respondida, 0 se não é resposta
+
+        constexpr size_t expectedLength(uint16_t n) const
+        {
+            return base + static_cast<size_t>(perItem) * (counted ? n : 0);
+        }
+};
+
+constexpr MessageLayout MESSAGE_LAYOUTS[] = {
+    { 1, "itr", 18, 0, false, 0 },                   // IndividualTokenRequest
+    { 2, "itr-reply", 82, 0, false, 1 },             // IndividualTokenResponse
+    { 3, "itv", 82, 0, false, 0 },                   // IndividualTokenValidation
+    { 4, "itv-reply", 83, 0, false, 3 },             // IndividualTokenStatus
+    { 5, "gtr", 4, 80, true, 0 },                    // GroupTokenRequest: 4+80N
+    { 6, "gtr-reply", 68, 80, true, 5 },             // GroupTokenResponse: 4+80N+64
+    { 7, "gtv", 68, 80, true, 0 },                   // GroupTokenValidation: 68+80N
+    { 8, "gtv-reply", 69, 80, true, 7 },             // GroupTokenStatus: 69+80N
+    { ERROR_RESPONSE_TYPE, "error", 4, 0, false, 0 } // ErrorResponse
+};
+
+constexpr size_t MAX_DENSE_TYPE = 8;
+
+// Tabela de despacho indexada diretamente pelo tipo (1..8); o erro 256 é tratado à
+// parte para não precisar de uma tabela com 257 entradas
+constexpr std::array<const MessageLayout*, MAX_DENSE_TYPE + 1> buildDispatchTable()
+{
+    std::array<const MessageLayout*, MAX_DENSE_TYPE + 1> table{};
+
+    for (const MessageLayout& layout : MESSAGE_LAYOUTS)
+    {
+        if (layout.type <= MAX_DENSE_TYPE)
+            table[layout.type] = &layout;
+    }
+
+    return table;
+}
+
+constexpr std::array<const MessageLayout*, MAX_DENSE_TYPE + 1> DISPATCH_TABLE =
+    buildDispatchTable();
+
+constexpr const MessageLayout* findLayout(uint16_t type)
+{
+    if (type <= MAX_DENSE_TYPE)
+        return DISPATCH_TABLE[type];
+
+    if (type == ERROR_RESPONSE_TYPE)
+        return &MESSAGE_LAYOUTS[std::size(MESSAGE_LAYOUTS) - 1];
+
+    return nullptr;
+}
+
+static_assert(findLayout(1)->expectedLength(0) == sizeof(IndividualTokenRequest));
+static_assert(findLayout(2)->expectedLength(0) == sizeof(IndividualTokenResponse));
+static_assert(findLayout(3)->expectedLength(0) == sizeof(IndividualTokenValidation));
+static_assert(findLayout(4)->expectedLength(0) == sizeof(IndividualTokenStatus));
+static_assert(findLayout(ERROR_RESPONSE_TYPE)->expectedLength(0) ==
+              sizeof(ErrorResponse));
+
+/**
+ * @brief Datagrama classificado; data aponta para o buffer de recepção (sem cópia)
+ */
+class Datagram
+{
+    public:
+        const MessageLayout* layout = nullptr;
+        const char*          data   = nullptr;
+        size_t               size   = 0;
+        uint16_t             n      = 0;
+};
+
+/**
+ * @brief Classifica um datagrama pelo campo de tipo e valida o tamanho do layout
+ */
+DemuxStatus classifyDatagram(const char* buffer, size_t size, Datagram& datagram)
+{
+    uint16_t type;
+
+    if (size < sizeof(type))
+        return DEMUX_TOO_SHORT;
+
+    std::memcpy(&type, buffer, sizeof(type));
+    const MessageLayout* layout = findLayout(fromNetworkShort(type));
+
+    if (!layout)
+        return DEMUX_UNKNOWN_TYPE;
+
+    uint16_t n = 0;
+    if (layout->counted)
+    {
+        if (size < sizeof(type) + sizeof(n))
+            return DEMUX_TOO_SHORT;
+
+        std::memcpy(&n, buffer + sizeof(type), sizeof(n));
+        n = fromNetworkShort(n);
+    }
+
+    if (size != layout->expectedLength(n))
+        return DEMUX_BAD_LENGTH;
+
+    datagram.layout = layout;
+    datagram.data   = buffer;
+    datagram.size   = size;
+    datagram.n      = n;
+
+    return DEMUX_OK;
+}
+
+const char* describeDemuxStatus(DemuxStatus status)
+{
+    switch (status)
+    {
+        case DEMUX_OK:
+            return "OK";
+        case DEMUX_TOO_SHORT:
+            return "Resposta curta demais para conter o tipo da mensagem";
+        case DEMUX_UNKNOWN_TYPE:
+            return "Resposta com tipo de mensagem desconhecido";
+        case DEMUX_BAD_LENGTH:
+            return "Resposta com tamanho incompatível com o tipo da mensagem";
+        case DEMUX_UNMATCHED:
+            return "Resposta não corresponde a nenhuma requisição pendente";
+        default:
+            return "Erro desconhecido";
+    }
+}
+
+/**
+ * @brief Requisição enviada e ainda sem resposta. packet aponta para o buffer
+ *        serializado, que deve permanecer válido até a resposta chegar
+ */
+class InFlightRequest
+{
+    public:
+        const char* packet   = nullptr;
+        size_t      size     = 0;
+        uint16_t    type     = 0;
+        uint64_t    sequence = 0;
+        void*       context  = nullptr;
+};
+
+/**
+ * @brief Encaminha respostas para a requisição pendente correspondente.
+ *
+ * Toda resposta do protocolo repete os bytes da requisição após o campo de tipo
+ * (ID/nonce, ID/nonce/token, N/SAS ou N/SAS/token), então a chave de uma requisição
+ * é o hash desses bytes, e a resposta é localizada calculando o mesmo hash sobre a
+ * região equivalente do datagrama recebido. Como ErrorResponse não carrega nada da
+ * requisição, um erro é atribuído à requisição pendente mais antiga.
+ */
+class ResponseDemux
+{
+    public:
+        void track(const char* packet, size_t size, void* context = nullptr)
+        {
+            InFlightRequest request;
+            uint16_t        type;
+
+            std::memcpy(&type, packet, sizeof(type));
+
+            request.packet   = packet;
+            request.size     = size;
+            request.type     = fromNetworkShort(type);
+            request.sequence = nextSequence++;
+            request.context  = context;
+
+            inFlight.emplace(echoKey(packet + sizeof(type), size - sizeof(type)),
+                             request);
+        }
+
+        size_t pending() const
+        {
+            return inFlight.size();
+        }
+
+        /**
+         * @brief Classifica o datagrama e remove a requisição que ele responde.
+         *        Um ErrorResponse é sempre atribuído à requisição pendente mais
+         *        antiga deste demux: num socket reaproveitado (modo daemon), um erro
+         *        atrasado de um comando anterior é cobrado da requisição mais antiga
+         *        do comando atual, pois nada no erro o distingue
+         */
+        DemuxStatus dispatch(const char*      buffer,
+                             size_t           size,
+                             Datagram&        datagram,
+                             InFlightRequest& request)
+        {
+            DemuxStatus status = classifyDatagram(buffer, size, datagram);
+
+            if (status != DEMUX_OK)
+                return status;
+
+            if (datagram.layout->type == ERROR_RESPONSE_TYPE)
+                return takeOldest(request);
+
+            if (!datagram.layout->replyTo)
+                return DEMUX_UNMATCHED;
+
+            // A região repetida tem o tamanho da requisição menos o campo de tipo
+            const MessageLayout* requestLayout = findLayout(datagram.layout->replyTo);
+            size_t               echoSize =
+                requestLayout->expectedLength(datagram.n) - sizeof(uint16_t);
+            const char* echo = buffer + sizeof(uint16_t);
+
+            auto range = inFlight.equal_range(echoKey(echo, echoSize));
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const InFlightRequest& candidate = it->second;
+
+                if (candidate.type == requestLayout->type &&
+                    candidate.size - sizeof(uint16_t) == echoSize &&
+                    std::memcmp(candidate.packet + sizeof(uint16_t), echo, echoSize) ==
+                        0)
+                {
+                    request = candidate;
+                    inFlight.erase(it);
+                    return DEMUX_OK;
+                }
+            }
+
+            return DEMUX_UNMATCHED;
+        }
+
+    private:
+        std::unordered_multimap<uint64_t, InFlightRequest> inFlight;
+        uint64_t                                           nextSequence = 0;
+
+        // FNV-1a de 64 bits
+        static uint64_t echoKey(const char* data, size_t size)
+        {
+            uint64_t hash = 14695981039346656037ULL;
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ULL;
+            }
+
+            return hash;
+        }
+
+        DemuxStatus takeOldest(InFlightRequest& request)
+        {
+            auto oldest = inFlight.end();
+
+            for (auto it = inFlight.begin(); it != inFlight.end(); ++it)
+            {
+                if (oldest == inFlight.end() ||
+                    it->second.sequence < oldest->second.sequence)
+                {
+                    oldest = it;
+                }
+            }
+
+            if (oldest == inFlight.end())
+                return DEMUX_UNMATCHED;
+
+            request = oldest->second;
+            inFlight.erase(oldest);
+
+            return DEMUX_OK;
+        }
+};
+
+#endif // DEMUX_H
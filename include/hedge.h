@@ -0,0 +1,232 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include "demux.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+const char   HEDGE_ENV[]          = "UDP_AUTH_HEDGE";        // <percentil>[:<%>]
+const char   HEDGE_TARGET_ENV[]   = "UDP_AUTH_HEDGE_TARGET"; // <host>:<port>
+const double HEDGE_DEFAULT_BUDGET = 5;    // % máximo de requisições extras
+const size_t HEDGE_MIN_SAMPLES    = 20;   // RTTs observados antes do primeiro hedge
+const size_t HEDGE_WINDOW         = 1024; // RTTs recentes usados no percentil
+const size_t HEDGE_REFRESH        = 64;   // novas amostras entre recálculos
+const double HEDGE_BUDGET_WINDOW  = 100;  // requisições em que o orçamento vale
+const size_t HEDGE_TYPES          = 9;    // tipos de requisição 1..8
+
+/**
+ * @brief Janela dos RTTs mais recentes de um tipo de requisição; o percentil é
+ *        recalculado a cada HEDGE_REFRESH amostras, não a cada requisição
+ */
+class RttWindow
+{
+    public:
+        uint64_t count  = 0;
+        uint64_t cached = 0;
+
+        void add(uint64_t ns, double percentile)
+        {
+            samples[count++ % HEDGE_WINDOW] = ns;
+
+            if (count == HEDGE_MIN_SAMPLES || count % HEDGE_REFRESH == 0)
+            {
+                size_t size  = std::min<uint64_t>(count, HEDGE_WINDOW);
+                size_t index = static_cast<size_t>(percentile / 100 * size);
+                index        = std::min(index, size - 1);
+
+                std::copy(samples, samples + size, scratch);
+                std::nth_element(scratch, scratch + index, scratch + size);
+                cached = scratch[index];
+            }
+        }
+
+    private:
+        uint64_t samples[HEDGE_WINDOW];
+        uint64_t scratch[HEDGE_WINDOW];
+};
+
+/**
+ * @brief Requisição idempotente (itv ou gtv) que pode ser enviada em duplicata. A
+ *        cópia sai de um socket próprio, fechado junto com a requisição: a resposta
+ *        que perder a corrida não fica para o próximo comando de um socket
+ *        reaproveitado
+ */
+class HedgedRequest
+{
+    public:
+        const char*                packet;
+        size_t                     size;
+        const char*                host; // servidor da requisição original
+        uint16_t                   port;
+        uint16_t                   type;
+        uint64_t                   sentAt;          // envio original, em monotonicNs()
+        bool                       decided = false; // cópia enviada ou recusada
+        std::unique_ptr<UdpSocket> duplicate;       // socket da cópia, quando enviada
+
+        HedgedRequest(const char* packet,
+                      size_t      size,
+                      const char* host,
+                      uint16_t    port,
+                      uint64_t    sentAt)
+            : packet(packet),
+              size(size),
+              host(host),
+              port(port),
+              sentAt(sentAt)
+        {
+            std::memcpy(&type, packet, sizeof(type));
+            type = fromNetworkShort(type);
+        }
+};
+
+/**
+ * @brief Quando e para onde enviar cópias de requisições sem resposta: após o
+ *        percentil configurado do RTT observado, desde que as cópias não passem do
+ *        orçamento de carga extra. Como o RTT vem do histórico do processo, o hedge
+ *        só começa depois de HEDGE_MIN_SAMPLES respostas (p.ex. no modo daemon).
+ *
+ *        O orçamento é um balde de fichas: cada requisição rende budget% de uma
+ *        cópia e o saldo não passa do que rendem HEDGE_BUDGET_WINDOW requisições.
+ *        Assim um período calmo não acumula crédito para uma rajada de cópias
+ *        justamente quando o servidor está com problemas
+ */
+class HedgePolicy
+{
+    public:
+        double      percentile = 0; // 0 desliga o hedge
+        double      budget     = HEDGE_DEFAULT_BUDGET;
+        std::string targetHost;     // vazio: a cópia vai para o mesmo servidor
+        uint16_t    targetPort = 0;
+
+        bool enabled() const
+        {
+            return percentile > 0;
+        }
+
+        // Atraso até a cópia; 0 enquanto não há amostras suficientes
+        uint64_t delayNs(uint16_t type) const
+        {
+            const RttWindow& window = windows[type % HEDGE_TYPES];
+            return window.count >= HEDGE_MIN_SAMPLES ? window.cached : 0;
+        }
+
+        void countRequest(uint16_t type)
+        {
+            requests[type % HEDGE_TYPES]++;
+
+            double capacity = std::max(1.0, budget / 100 * HEDGE_BUDGET_WINDOW);
+            tokens          = std::min(capacity, tokens + budget / 100);
+        }
+
+        void recordRtt(uint16_t type, uint64_t ns)
+        {
+            windows[type % HEDGE_TYPES].add(ns, percentile);
+        }
+
+        // Consome uma ficha do orçamento, se houver
+        bool tryHedge(uint16_t type)
+        {
+            if (tokens < 1)
+                return false;
+
+            hedges[type % HEDGE_TYPES]++;
+            tokens -= 1;
+            return true;
+        }
+
+        void countHedgedReply(uint16_t type)
+        {
+            hedgedReplies[type % HEDGE_TYPES]++;
+        }
+
+        void report(std::ostream& os) const
+        {
+            os << std::left << std::setw(6) << "type" << std::right << std::setw(10)
+               << "requests" << std::setw(10) << "hedges" << std::setw(10) << "extra %"
+               << std::setw(12) << "after hedge" << std::setw(12) << "delay us"
+               << std::endl;
+
+            os << std::fixed << std::setprecision(3);
+            for (size_t type = 0; type < HEDGE_TYPES; ++type)
+            {
+                if (!requests[type])
+                    continue;
+
+                os << std::left << std::setw(6) << findLayout(type)->name << std::right
+                   << std::setw(10) << requests[type] << std::setw(10) << hedges[type]
+                   << std::setw(10) << 100.0 * hedges[type] / requests[type]
+                   << std::setw(12) << hedgedReplies[type] << std::setw(12)
+                   << delayNs(type) / 1e3 << std::endl;
+            }
+            os << std::defaultfloat;
+        }
+
+    private:
+        RttWindow windows[HEDGE_TYPES];
+        uint64_t  requests[HEDGE_TYPES]      = {};
+        uint64_t  hedges[HEDGE_TYPES]        = {};
+        uint64_t  hedgedReplies[HEDGE_TYPES] = {}; // respostas recebidas após a cópia
+        double    tokens                     = 0;  // cópias disponíveis no orçamento
+};
+
+/**
+ * @brief Lê UDP_AUTH_HEDGE=<percentil>[:<orçamento %>], p.ex. 95:5, e opcionalmente
+ *        UDP_AUTH_HEDGE_TARGET=<host>:<port> para enviar as cópias a outro servidor
+ */
+bool configureHedgePolicy(HedgePolicy& policy)
+{
+    const char* config = std::getenv(HEDGE_ENV);
+
+    if (!config || !*config)
+        return false;
+
+    double      percentile = atof(config);
+    const char* separator  = strchr(config, ':');
+
+    if (percentile <= 0 || percentile >= 100)
+    {
+        std::cerr << "Aviso: percentil de hedge inválido; hedge desligado"
+                  << std::endl;
+        return false;
+    }
+
+    policy.percentile = percentile;
+    if (separator)
+        policy.budget = std::max(0.0, atof(separator + 1));
+
+    const char* target = std::getenv(HEDGE_TARGET_ENV);
+    if (!target || !*target)
+        return true;
+
+    const char* port = strrchr(target, ':');
+    if (!port)
+    {
+        std::cerr << "Aviso: alvo de hedge inválido (esperado <host>:<port>); "
+                     "usando o servidor principal"
+                  << std::endl;
+        return true;
+    }
+
+    policy.targetHost.assign(target, port - target);
+    policy.targetPort = atoi(port + 1);
+
+    return true;
+}
+
+HedgePolicy& hedgePolicy()
+{
+    static HedgePolicy policy;
+    static bool        configured = configureHedgePolicy(policy);
+
+    (void)configured;
+    return policy;
+}
+
+#endif // HEDGE_H
@@ -0,0 +1,209 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdint.h>
+#include <time.h>
+
+const char TIMING_ENV[] = "UDP_AUTH_TIMING";
+
+/**
+ * @brief Instante atual em ns no CLOCK_REALTIME, o mesmo relógio dos timestamps de
+ *        software do SO_TIMESTAMPING, para que as marcas possam ser subtraídas
+ */
+uint64_t realtimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Instante atual em ns no CLOCK_MONOTONIC, para intervalos que não podem
+ *        sofrer ajustes do relógio (p.ex. o atraso do hedge)
+ */
+uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Marcas registradas ao longo de uma requisição, em ordem cronológica
+enum LatencyMark
+{
+    MARK_START,        // antes de criar o socket
+    MARK_RESOLVED,     // getaddrinfo concluído
+    MARK_SOCKET_READY, // socket criado e configurado
+    MARK_PARSED,       // argumentos convertidos para a mensagem
+    MARK_SERIALIZED,   // mensagem serializada no buffer de envio
+    MARK_SENT,         // sendto retornou
+    MARK_KERNEL_TX,    // timestamp de software do envio, no kernel
+    MARK_KERNEL_RX,    // timestamp de software da recepção, no kernel
+    MARK_RECEIVED,     // recvfrom retornou
+    MARK_DECODED,      // resposta classificada e pronta para a saída
+    MARK_NIC_TX,       // timestamp de hardware do envio, no relógio da NIC (PHC)
+    MARK_NIC_RX,       // timestamp de hardware da recepção, no relógio da NIC (PHC)
+    MARK_COUNT
+};
+
+/**
+ * @brief Timestamps de um datagrama dados pelo SO_TIMESTAMPING: o de software está
+ *        no CLOCK_REALTIME, como as marcas do processo; o de hardware está no
+ *        relógio da NIC e só pode ser comparado com outro timestamp de hardware
+ */
+class PacketTimestamp
+{
+    public:
+        uint64_t software = 0;
+        uint64_t hardware = 0;
+};
+
+class LatencyStage
+{
+    public:
+        const char* name;
+        LatencyMark from;
+        LatencyMark to;
+};
+
+const LatencyStage LATENCY_STAGES[] = {
+    { "resolve", MARK_START, MARK_RESOLVED },
+    { "socket", MARK_RESOLVED, MARK_SOCKET_READY },
+    { "parse", MARK_SOCKET_READY, MARK_PARSED },
+    { "serialize", MARK_PARSED, MARK_SERIALIZED },
+    { "send", MARK_SERIALIZED, MARK_SENT },
+    { "tx stack", MARK_SERIALIZED, MARK_KERNEL_TX },
+    { "wire+server", MARK_KERNEL_TX, MARK_KERNEL_RX },
+    { "rx wakeup", MARK_KERNEL_RX, MARK_RECEIVED },
+    { "nic rtt", MARK_NIC_TX, MARK_NIC_RX }, // só entre timestamps de hardware
+    { "decode", MARK_RECEIVED, MARK_DECODED },
+    { "total", MARK_START, MARK_DECODED },
+};
+
+const size_t STAGE_COUNT = sizeof(LATENCY_STAGES) / sizeof(LATENCY_STAGES[0]);
+
+/**
+ * @brief Histograma em escala log2 de durações em ns
+ */
+class LatencyHistogram
+{
+    public:
+        static const size_t BUCKETS = 40; // até ~9 minutos
+
+        uint64_t count = 0;
+        uint64_t sum   = 0;
+        uint64_t min   = UINT64_MAX;
+        uint64_t max   = 0;
+        uint64_t buckets[BUCKETS] = {};
+
+        void add(uint64_t ns)
+        {
+            size_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+            buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+
+            count++;
+            sum += ns;
+            min = ns < min ? ns : min;
+            max = ns > max ? ns : max;
+        }
+
+        // Limite superior do bucket que contém o percentil p, limitado a [min, max]
+        uint64_t percentile(double p) const
+        {
+            uint64_t target = static_cast<uint64_t>(p * count);
+            uint64_t seen   = 0;
+
+            for (size_t i = 0; i < BUCKETS; ++i)
+            {
+                seen += buckets[i];
+                if (seen > target)
+                {
+                    uint64_t upper = i ? (1ULL << i) - 1 : 0;
+                    return std::clamp(upper, min, max);
+                }
+            }
+
+            return max;
+        }
+};
+
+class LatencyTrace
+{
+    public:
+        uint64_t marks[MARK_COUNT] = {};
+
+        void mark(LatencyMark which, uint64_t ns = 0)
+        {
+            marks[which] = ns ? ns : realtimeNs();
+        }
+};
+
+/**
+ * @brief Agrega as durações de cada estágio de todas as requisições do processo
+ */
+class LatencyProfile
+{
+    public:
+        LatencyHistogram stages[STAGE_COUNT];
+
+        // Estágios sem uma das marcas (p.ex. sem timestamp do kernel) são ignorados
+        void record(const LatencyTrace& trace)
+        {
+            for (size_t i = 0; i < STAGE_COUNT; ++i)
+            {
+                uint64_t from = trace.marks[LATENCY_STAGES[i].from];
+                uint64_t to   = trace.marks[LATENCY_STAGES[i].to];
+
+                if (from && to && to >= from)
+                    stages[i].add(to - from);
+            }
+        }
+
+        void report(std::ostream& os) const
+        {
+            os << std::left << std::setw(12) << "stage" << std::right << std::setw(8)
+               << "count" << std::setw(12) << "min us" << std::setw(12) << "avg us"
+               << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+               << std::setw(12) << "max us" << std::endl;
+
+            os << std::fixed << std::setprecision(3);
+            for (size_t i = 0; i < STAGE_COUNT; ++i)
+            {
+                const LatencyHistogram& h = stages[i];
+
+                if (!h.count)
+                    continue;
+
+                os << std::left << std::setw(12) << LATENCY_STAGES[i].name << std::right
+                   << std::setw(8) << h.count << std::setw(12) << h.min / 1e3
+                   << std::setw(12) << static_cast<double>(h.sum) / h.count / 1e3
+                   << std::setw(12) << h.percentile(0.50) / 1e3 << std::setw(12)
+                   << h.percentile(0.99) / 1e3 << std::setw(12) << h.max / 1e3
+                   << std::endl;
+            }
+            os << std::defaultfloat;
+        }
+};
+
+bool timingEnabled()
+{
+    static bool enabled = []() {
+        const char* value = std::getenv(TIMING_ENV);
+        return value && *value && *value != '0';
+    }();
+
+    return enabled;
+}
+
+LatencyProfile& latencyProfile()
+{
+    static LatencyProfile profile;
+    return profile;
+}
+
+#endif // TIMING_H
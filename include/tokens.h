@@ -1,11 +1,19 @@
+#ifndef TOKENS_H
+#define TOKENS_H
+
 #include "utils.h"
 #include <cstdlib>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <stdexcept>
 #include <stdint.h>
 #include <vector>
 
+// Maior N de gtr/gtv em que todas as mensagens do grupo, inclusive a maior delas (a
+// resposta do gtv, 69+80N), cabem em um único datagrama UDP
+const uint16_t MAX_GROUP_SIZE = (MAX_UDP_PAYLOAD - 69) / 80;
+
 /* [1]
 
     0         2                        14                  18
@@ -216,6 +224,14 @@ class SAS
                         std::min(tokenStr.size(), sizeof(token)));
         }
 
+        // Monta o SAS direto da resposta, sem passar pela representação textual
+        SAS(const IndividualTokenResponse& response)
+            : nonce(response.nonce)
+        {
+            std::memcpy(id, response.id, sizeof(id));
+            std::memcpy(token, response.token, sizeof(token));
+        }
+
         void serialize(char* buffer, size_t offset = 0)
         {
             std::memcpy(buffer + offset, id, sizeof(id)); // Copia o id
@@ -228,31 +244,6 @@ class SAS
         }
 } __attribute__((packed));
 
-class BaseGroupToken
-{
-    public:
-        uint16_t type;
-        uint16_t n;
-        char*    sas;
-
-        BaseGroupToken(uint16_t type, uint16_t n)
-            : type(toNetworkShort(type)),
-              n(toNetworkShort(n))
-        {
-            sas = static_cast<char*>(std::malloc(80 * n));
-
-            if (!sas)
-                throw std::bad_alloc();
-
-            std::memset(sas, CLEAN_CHAR, 80 * n);
-        }
-
-        ~BaseGroupToken()
-        {
-            std::free(sas);
-        }
-} __attribute__((packed));
-
 /* [5]
 
     0       2       4          84         164       4+80N
@@ -267,33 +258,20 @@ class GroupTokenRequest
         uint16_t n;
         char*    sas;
 
-        GroupTokenRequest(uint16_t type, uint16_t n)
-            : type(toNetworkShort(type)),
-              n(toNetworkShort(n))
-        {
-            sas = static_cast<char*>(std::malloc(80 * n));
-
-            if (!sas)
-                throw std::bad_alloc();
-
-            std::memset(sas, CLEAN_CHAR, 80 * n);
-        }
-
-        ~GroupTokenRequest()
-        {
-            std::free(sas);
-        }
-
         GroupTokenRequest(std::vector<SAS>& gas)
             : type(toNetworkShort(5)),
               n(toNetworkShort(gas.size()))
         {
-            sas = static_cast<char*>(std::malloc(80 * n));
+            if (gas.size() > MAX_GROUP_SIZE)
+                throw std::length_error("Grupo maior que MAX_GROUP_SIZE");
+
+            // n já está na ordem de rede: o tamanho vem do vetor
+            sas = static_cast<char*>(std::malloc(80 * gas.size()));
 
             if (!sas)
                 throw std::bad_alloc();
 
-            std::memset(sas, CLEAN_CHAR, 80 * n);
+            std::memset(sas, CLEAN_CHAR, 80 * gas.size());
 
             for (uint16_t i = 0; i < gas.size(); i++)
             {
@@ -301,6 +279,11 @@ class GroupTokenRequest
             }
         }
 
+        ~GroupTokenRequest()
+        {
+            std::free(sas);
+        }
+
         size_t packetSize() const
         {
             return sizeof(type) + sizeof(n) + 80 * fromNetworkShort(n);
@@ -324,7 +307,35 @@ class GroupTokenRequest
     | 6     | N     | SAS-1    | SAS-2     | SAS-N     | token   |
     +---+---+---+---+--/    /--+--/     /--+--/     /--+--/   /---
 */
-// class GroupTokenResponse
+class GroupTokenResponse
+{
+    public:
+        uint16_t    type;
+        uint16_t    n;
+        const char* sas;
+        const char* token;
+
+        // Visão sobre o datagrama recebido; o buffer deve sobreviver à resposta
+        GroupTokenResponse(const char* buffer)
+        {
+            std::memcpy(&type, buffer, sizeof(type));
+            std::memcpy(&n, buffer + sizeof(type), sizeof(n));
+            sas   = buffer + sizeof(type) + sizeof(n);
+            token = sas + 80 * fromNetworkShort(n);
+        }
+
+        size_t packetSize() const
+        {
+            return sizeof(type) + sizeof(n) + 80 * fromNetworkShort(n) + 64;
+        }
+
+        friend std::ostream& operator<<(std::ostream&             os,
+                                        const GroupTokenResponse& response)
+        {
+            os.write(response.token, 64);
+            return os;
+        }
+};
 
 /* [7]
 
@@ -345,12 +356,15 @@ class GroupTokenValidation
             : type(toNetworkShort(7)),
               n(toNetworkShort(gas.size()))
         {
-            sas = static_cast<char*>(std::malloc(80 * n));
+            if (gas.size() > MAX_GROUP_SIZE)
+                throw std::length_error("Grupo maior que MAX_GROUP_SIZE");
+
+            sas = static_cast<char*>(std::malloc(80 * gas.size()));
 
             if (!sas)
                 throw std::bad_alloc();
 
-            std::memset(sas, CLEAN_CHAR, 80 * n);
+            std::memset(sas, CLEAN_CHAR, 80 * gas.size());
 
             std::memset(this->token, CLEAN_CHAR, sizeof(this->token));
             std::memcpy(this->token,
@@ -394,7 +408,37 @@ class GroupTokenValidation
     | 8     | N     | SAA-1     | SAA-2     | SAA-N     | token   | s |
     +---+---+---+---+--/     /--+--/     /--+--/     /--+--/   /--+---|
 */
-//class GroupTokenStatus 
+class GroupTokenStatus
+{
+    public:
+        uint16_t    type;
+        uint16_t    n;
+        const char* sas;
+        const char* token;
+        char        status;
+
+        // Visão sobre o datagrama recebido; o buffer deve sobreviver ao status
+        GroupTokenStatus(const char* buffer)
+        {
+            std::memcpy(&type, buffer, sizeof(type));
+            std::memcpy(&n, buffer + sizeof(type), sizeof(n));
+            sas    = buffer + sizeof(type) + sizeof(n);
+            token  = sas + 80 * fromNetworkShort(n);
+            status = token[64];
+        }
+
+        size_t packetSize() const
+        {
+            return sizeof(type) + sizeof(n) + 80 * fromNetworkShort(n) + 64 +
+                   sizeof(status);
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const GroupTokenStatus& status)
+        {
+            os << static_cast<int>(status.status);
+            return os;
+        }
+};
 
 /* [9]
 
@@ -496,4 +540,6 @@ int getGroupTokenStatus(const char* buffer, GroupTokenValidation& gtv)
     std::memcpy(&status, buffer + offset, sizeof(status));
 
     return static_cast<int>(status);
-}
\ No newline at end of file
+}
+
+#endif // TOKENS_H
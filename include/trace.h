@@ -0,0 +1,362 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "capture.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+const char     TRACE_ENV[]        = "UDP_AUTH_TRACE";        // caminho do arquivo
+const char     TRACE_FORMAT_ENV[] = "UDP_AUTH_TRACE_FORMAT"; // binary (padrão) ou hex
+const char     TRACE_MAGIC[4]     = { 'U', 'A', 'T', 'R' };
+const uint16_t TRACE_VERSION      = 1;
+const size_t   TRACE_PREFIX       = 96;   // bytes do payload guardados por datagrama
+const size_t   TRACE_RING_SLOTS   = 8192; // por thread, potência de 2
+const int      TRACE_DRAIN_MS     = 2;
+
+static_assert((TRACE_RING_SLOTS & (TRACE_RING_SLOTS - 1)) == 0);
+
+/* Cabeçalho do arquivo de trace binário
+
+    0                   4         6         8
+    +----+----+----+----+----+----+----+----+
+    | "UATR"            | version | prefix  |
+    +----+----+----+----+----+----+----+----+
+*/
+class TraceFileHeader
+{
+    public:
+        char     magic[4];
+        uint16_t version;
+        uint16_t prefix;
+
+        TraceFileHeader()
+            : version(TRACE_VERSION),
+              prefix(TRACE_PREFIX)
+        {
+            std::memcpy(magic, TRACE_MAGIC, sizeof(magic));
+        }
+} __attribute__((packed));
+
+/* Registro de um datagrama (ordem de bytes do host), seguido de captured bytes do
+   início do payload; length é o tamanho original do datagrama
+
+    0                   8         12     14    15         16       18
+    +----/      /-------+---------+------+-----+----------+--------+---/   /---+
+    | timestamp (ns)    | thread  | chan | dir | captured | length | prefix    |
+    +----/      /-------+---------+------+-----+----------+--------+---/   /---+
+*/
+class TraceRecord
+{
+    public:
+        uint64_t timestamp;
+        uint32_t thread;
+        uint16_t channel;
+        uint8_t  direction;
+        uint8_t  captured;
+        uint16_t length;
+} __attribute__((packed));
+
+static_assert(TRACE_PREFIX <= UINT8_MAX);
+
+class alignas(64) TraceSlot
+{
+    public:
+        TraceRecord record;
+        char        prefix[TRACE_PREFIX];
+};
+
+/**
+ * @brief Fila circular de um produtor (a thread dona) e um consumidor (a thread de
+ *        escrita). O produtor nunca espera: com a fila cheia o registro é descartado
+ */
+class TraceRing
+{
+    public:
+        TraceRing()
+            : slots(new TraceSlot[TRACE_RING_SLOTS]),
+              thread(static_cast<uint32_t>(gettid()))
+        { }
+
+        void push(CaptureDirection direction,
+                  uint16_t         channel,
+                  const void*      data,
+                  size_t           size)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+
+            if (h - tail.load(std::memory_order_acquire) == TRACE_RING_SLOTS)
+            {
+                dropped.store(dropped.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+                return;
+            }
+
+            TraceSlot& slot       = slots[h & (TRACE_RING_SLOTS - 1)];
+            slot.record.timestamp = captureTimestamp();
+            slot.record.thread    = thread;
+            slot.record.channel   = channel;
+            slot.record.direction = direction;
+            slot.record.captured  = std::min(size, TRACE_PREFIX);
+            slot.record.length    = std::min<size_t>(size, UINT16_MAX);
+            std::memcpy(slot.prefix, data, slot.record.captured);
+
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        // Entrega ao consumidor todos os registros publicados até agora
+        template <typename Consumer> size_t drain(Consumer&& consume)
+        {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            uint64_t h = head.load(std::memory_order_acquire);
+
+            for (uint64_t i = t; i != h; ++i)
+                consume(slots[i & (TRACE_RING_SLOTS - 1)]);
+
+            tail.store(h, std::memory_order_release);
+            return h - t;
+        }
+
+        uint64_t droppedCount() const
+        {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::unique_ptr<TraceSlot[]> slots;
+        uint32_t                     thread;
+        alignas(64) std::atomic<uint64_t> head{ 0 };
+        alignas(64) std::atomic<uint64_t> tail{ 0 };
+        std::atomic<uint64_t>             dropped{ 0 };
+};
+
+/**
+ * @brief Trace assíncrono dos datagramas: cada thread copia cabeçalho e prefixo do
+ *        payload para a sua TraceRing, e uma thread de fundo esvazia as filas a cada
+ *        TRACE_DRAIN_MS no arquivo, em binário ou em hex dump. Diferente do
+ *        CaptureWriter, o caminho de envio/recepção não faz nenhuma syscall
+ */
+class PacketTracer
+{
+    public:
+        static constexpr size_t BUFFER_SIZE = 256 * 1024;
+
+        PacketTracer(const char* path, bool hex)
+            : hex(hex)
+        {
+            // O_APPEND e escritas só de registros inteiros, como na captura, para que
+            // várias execuções compartilhem o arquivo
+            fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                perror("Erro ao abrir arquivo de trace");
+                return;
+            }
+
+            struct stat st;
+            if (!hex && fstat(fd, &st) == 0 && st.st_size == 0)
+            {
+                TraceFileHeader header;
+                if (write(fd, &header, sizeof(header)) < 0)
+                    perror("Erro ao escrever arquivo de trace");
+            }
+
+            buffer.reset(new char[BUFFER_SIZE]);
+            worker = std::thread(&PacketTracer::run, this);
+        }
+
+        ~PacketTracer()
+        {
+            if (fd < 0)
+                return;
+
+            stopping = true;
+            worker.join();
+            drainAll(); // registros publicados depois da última passada
+
+            uint64_t dropped = 0;
+            for (const std::unique_ptr<TraceRing>& ring : rings)
+                dropped += ring->droppedCount();
+
+            if (dropped)
+            {
+                std::cerr << "Aviso: " << dropped
+                          << " datagrama(s) descartado(s) do trace (fila cheia)"
+                          << std::endl;
+            }
+
+            close(fd);
+        }
+
+        bool isOpen() const
+        {
+            return fd >= 0;
+        }
+
+        void record(CaptureDirection direction,
+                    uint16_t         channel,
+                    const void*      data,
+                    size_t           size)
+        {
+            thread_local TraceRing* ring = nullptr;
+
+            if (!ring)
+                ring = registerRing();
+
+            ring->push(direction, channel, data, size);
+        }
+
+    private:
+        int                                     fd;
+        bool                                    hex;
+        std::unique_ptr<char[]>                 buffer;
+        size_t                                  used = 0;
+        std::mutex                              ringsLock;
+        std::vector<std::unique_ptr<TraceRing>> rings;
+        std::atomic<bool>                       stopping{ false };
+        std::thread                             worker;
+
+        // Uma vez por thread; as filas vivem até o fim do tracer, mesmo que a thread
+        // termine antes
+        TraceRing* registerRing()
+        {
+            std::lock_guard<std::mutex> guard(ringsLock);
+            rings.emplace_back(new TraceRing());
+            return rings.back().get();
+        }
+
+        void run()
+        {
+            const auto interval = std::chrono::milliseconds(TRACE_DRAIN_MS);
+
+            while (!stopping.load(std::memory_order_relaxed))
+            {
+                if (!drainAll())
+                    std::this_thread::sleep_for(interval);
+            }
+        }
+
+        size_t drainAll()
+        {
+            size_t drained = 0;
+
+            {
+                std::lock_guard<std::mutex> guard(ringsLock);
+
+                for (const std::unique_ptr<TraceRing>& ring : rings)
+                {
+                    drained += ring->drain([this](const TraceSlot& slot) {
+                        hex ? appendHex(slot) : appendBinary(slot);
+                    });
+                }
+            }
+
+            flush();
+            return drained;
+        }
+
+        // Pior caso de uma linha do hex dump: campos numéricos + 3 caracteres por byte
+        static constexpr size_t MAX_ENTRY = 96 + 3 * TRACE_PREFIX;
+
+        void appendBinary(const TraceSlot& slot)
+        {
+            if (used + MAX_ENTRY > BUFFER_SIZE)
+                flush();
+
+            std::memcpy(buffer.get() + used, &slot.record, sizeof(slot.record));
+            used += sizeof(slot.record);
+            std::memcpy(buffer.get() + used, slot.prefix, slot.record.captured);
+            used += slot.record.captured;
+        }
+
+        // <timestamp> <thread> <canal> send|recv <tamanho> <prefixo em hex>
+        void appendHex(const TraceSlot& slot)
+        {
+            static const char digits[] = "0123456789abcdef";
+
+            if (used + MAX_ENTRY > BUFFER_SIZE)
+                flush();
+
+            char*              out    = buffer.get() + used;
+            const TraceRecord& record = slot.record;
+
+            out += snprintf(out,
+                            96,
+                            "%llu %u %u %s %u",
+                            static_cast<unsigned long long>(record.timestamp),
+                            record.thread,
+                            record.channel,
+                            record.direction == CAPTURE_SENT ? "send" : "recv",
+                            record.length);
+
+            for (size_t i = 0; i < record.captured; ++i)
+            {
+                unsigned char byte = slot.prefix[i];
+                *out++             = ' ';
+                *out++             = digits[byte >> 4];
+                *out++             = digits[byte & 0xf];
+            }
+            *out++ = '\n';
+
+            used = out - buffer.get();
+        }
+
+        void flush()
+        {
+            size_t written = 0;
+
+            while (written < used)
+            {
+                ssize_t len = write(fd, buffer.get() + written, used - written);
+
+                if (len < 0 && errno == EINTR)
+                    continue;
+
+                if (len < 0)
+                {
+                    perror("Erro ao escrever arquivo de trace");
+                    break;
+                }
+
+                written += len;
+            }
+
+            used = 0;
+        }
+};
+
+/**
+ * @brief Retorna o tracer configurado por UDP_AUTH_TRACE, ou nullptr quando o trace
+ *        está desligado
+ */
+PacketTracer* activeTracer()
+{
+    static PacketTracer* tracer = []() -> PacketTracer* {
+        const char* path   = std::getenv(TRACE_ENV);
+        const char* format = std::getenv(TRACE_FORMAT_ENV);
+
+        if (!path || !*path)
+            return nullptr;
+
+        static PacketTracer instance(path, format && std::strcmp(format, "hex") == 0);
+        return instance.isOpen() ? &instance : nullptr;
+    }();
+
+    return tracer;
+}
+
+#endif // TRACE_H
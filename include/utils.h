@@ -1,17 +1,65 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include "capture.h"
+#include "timing.h"
+#include "trace.h"
 #include <algorithm>
+#include <cerrno>
 #include <arpa/inet.h>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <iomanip>
 #include <iostream>
+#include <linux/net_tstamp.h>
 #include <netdb.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sstream>
 #include <stdint.h>
 #include <unistd.h>
 
-const uint16_t DEFAULT_TIMEOUT = 3; // seconds
-const uint16_t BUF_SIZE        = 1024;
-const char     CLEAN_CHAR      = ' ';
+const uint16_t DEFAULT_TIMEOUT  = 3; // seconds
+const uint16_t MAX_RETRIES      = 3;
+const uint16_t BUF_SIZE         = 1024;
+const uint16_t MAX_DATAGRAM     = 65535;
+const uint16_t MAX_UDP_PAYLOAD  = 65507; // maior payload UDP sobre IPv4
+const uint16_t GSO_MAX_SEGMENTS = 64;    // UDP_MAX_SEGMENTS do kernel
+const int      BUSY_POLL_USEC   = 50;
+const char     CLEAN_CHAR       = ' ';
+
+/**
+ * @brief Lançada por fail() quando o processo atende vários comandos (modo daemon)
+ *        e só o comando atual deve ser abortado
+ */
+class CommandFailure : public std::exception
+{
+    public:
+        const char* what() const noexcept override
+        {
+            return "Falha no comando";
+        }
+};
+
+bool& failureThrows()
+{
+    static bool throws = false;
+    return throws;
+}
+
+/**
+ * @brief Encerra o comando atual com falha: termina o processo no cliente ou lança
+ *        CommandFailure no modo daemon. A mensagem já deve ter sido impressa
+ */
+[[noreturn]] void fail()
+{
+    if (failureThrows())
+        throw CommandFailure();
+
+    exit(EXIT_FAILURE);
+}
 
 class UdpSocket
 {
@@ -19,6 +67,8 @@ class UdpSocket
         UdpSocket(const std::string& host,
                   uint16_t           port,
                   uint16_t           timeout = DEFAULT_TIMEOUT)
+            : capture(activeCapture()),
+              tracer(activeTracer())
         {
             struct addrinfo hints{}, *res;
             hints.ai_family   = AF_UNSPEC;
@@ -28,15 +78,16 @@ class UdpSocket
             if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &res) != 0)
             {
                 perror("Erro ao resolver host");
-                exit(EXIT_FAILURE);
+                fail();
             }
+            resolved_at = realtimeNs();
 
             sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
             if (sockfd < 0)
             {
                 perror("Erro ao criar socket");
                 freeaddrinfo(res);
-                exit(EXIT_FAILURE);
+                fail();
             }
 
             memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
@@ -54,8 +105,9 @@ class UdpSocket
             {
                 perror("Erro ao configurar timeout");
                 close(sockfd);
-                exit(EXIT_FAILURE);
+                fail();
             }
+            ready_at = realtimeNs();
         }
 
         ~UdpSocket()
@@ -65,6 +117,8 @@ class UdpSocket
 
         ssize_t send(const void* data, size_t size)
         {
+            recordDatagram(CAPTURE_SENT, data, size);
+
             return sendto(sockfd,
                           data,
                           size,
@@ -75,18 +129,429 @@ class UdpSocket
 
         ssize_t receive(void* buffer, size_t size)
         {
-            return recvfrom(sockfd,
-                            buffer,
-                            size,
-                            0,
-                            (struct sockaddr*)&server_addr,
-                            &server_addr_len);
+            // Modo de baixa latência: tenta sem bloquear antes de dormir no kernel
+            for (uint32_t spin = 0; spin < spinBudget; ++spin)
+            {
+                ssize_t len = receiveFrom(buffer, size, MSG_DONTWAIT);
+
+                if (len >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    return len;
+            }
+
+            return receiveFrom(buffer, size, 0);
+        }
+
+        /**
+         * @brief Descarta sem bloquear os datagramas já recebidos e os timestamps de
+         *        envio pendentes, p.ex. respostas atrasadas de um comando anterior
+         *        que reaproveitou o socket
+         */
+        void discardPending()
+        {
+            while (true)
+            {
+                // Em UDP, recv de tamanho 0 consome o datagrama inteiro
+                ssize_t len = recv(sockfd, nullptr, 0, MSG_DONTWAIT);
+
+                if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+            }
+
+            sendTimestamp();
+        }
+
+        /**
+         * @brief Liga o modo de baixa latência do receive: SO_BUSY_POLL no socket e
+         *        até spin tentativas de recvfrom sem bloquear antes de voltar à espera
+         *        bloqueante. Com cpu >= 0 a thread atual é fixada nesse núcleo
+         * @return false se SO_BUSY_POLL ou a afinidade foram recusados (p.ex. sem
+         *         CAP_NET_ADMIN acima de net.core.busy_read); o spin vale mesmo assim
+         */
+        bool enableBusyPoll(uint32_t spin,
+                            int      cpu          = -1,
+                            int      busyPollUsec = BUSY_POLL_USEC)
+        {
+            spinBudget = spin;
+
+            bool applied = setsockopt(sockfd,
+                                      SOL_SOCKET,
+                                      SO_BUSY_POLL,
+                                      &busyPollUsec,
+                                      sizeof(busyPollUsec)) == 0;
+
+            if (cpu >= 0)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(cpu, &cpus);
+
+                applied &=
+                    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+            }
+
+            return applied;
+        }
+
+        int fd() const
+        {
+            return sockfd;
+        }
+
+        // Instantes (CLOCK_REALTIME, ns) em que o host foi resolvido e em que o
+        // socket ficou pronto, para separar esses custos na latência da requisição
+        uint64_t resolvedAt() const
+        {
+            return resolved_at;
+        }
+
+        uint64_t readyAt() const
+        {
+            return ready_at;
+        }
+
+        /**
+         * @brief Liga o SO_TIMESTAMPING: o kernel (e também a NIC, se o timestamping
+         *        de hardware estiver habilitado na interface) passa a marcar o envio e
+         *        a recepção de cada datagrama. Ver sendTimestamp e receiveTimestamp
+         */
+        bool enableTimestamping()
+        {
+            int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                        SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE |
+                        SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                        SOF_TIMESTAMPING_OPT_TSONLY;
+
+            int result =
+                setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+
+            timestamping = result == 0;
+            return timestamping;
+        }
+
+        /**
+         * @brief Timestamps do último envio, lidos da fila de erros do socket. O
+         *        kernel entrega os de software e de hardware em mensagens separadas
+         * @return campos zerados se o timestamping está desligado ou o timestamp
+         *         ainda não chegou
+         */
+        PacketTimestamp sendTimestamp()
+        {
+            PacketTimestamp latest;
+
+            if (!timestamping)
+                return latest;
+
+            while (true)
+            {
+                char          control[CMSG_SPACE(sizeof(struct timespec) * 3) + 128];
+                struct msghdr msg{};
+                msg.msg_control    = control;
+                msg.msg_controllen = sizeof(control);
+
+                if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                    break;
+
+                PacketTimestamp ts = readTimestamp(msg);
+                latest.software    = ts.software ? ts.software : latest.software;
+                latest.hardware    = ts.hardware ? ts.hardware : latest.hardware;
+            }
+
+            return latest;
+        }
+
+        // Timestamps do último datagrama recebido, zerados se indisponíveis
+        PacketTimestamp receiveTimestamp() const
+        {
+            return rx_timestamp;
+        }
+
+        /**
+         * @brief Liga o envio segmentado (UDP GSO) quando o kernel suporta
+         * @return false se UDP_SEGMENT não é suportado; sendSegmented continua
+         *         funcionando, mas envia os datagramas com sendmmsg
+         */
+        bool enableSegmentation()
+        {
+            int size = 0;
+
+            segmentation =
+                setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) == 0;
+            return segmentation;
+        }
+
+        /**
+         * @brief Liga (ou desliga) a recepção de datagramas agregados (UDP GRO)
+         *        quando o kernel suporta. Ver receiveCoalesced
+         */
+        bool enableCoalescing(bool enable = true)
+        {
+            int on = enable;
+            return setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+        }
+
+        /**
+         * @brief Envia count datagramas de segmentSize bytes armazenados em sequência
+         *        em data. Com GSO cada chamada ao kernel leva até GSO_MAX_SEGMENTS
+         *        datagramas; sem GSO, ou se o kernel recusar, usa sendmmsg
+         * @return número de datagramas enviados, ou -1 se nenhum foi enviado (com
+         *         errno EINVAL se segmentSize é 0 ou não cabe em um datagrama)
+         */
+        ssize_t sendSegmented(const void* data, uint16_t segmentSize, size_t count)
+        {
+            const char* bytes = static_cast<const char*>(data);
+            size_t      sent  = 0;
+
+            if (segmentSize == 0 || segmentSize > MAX_UDP_PAYLOAD)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            if (capture || tracer)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    recordDatagram(CAPTURE_SENT, bytes + i * segmentSize, segmentSize);
+            }
+
+            while (sent < count)
+            {
+                size_t batch = std::min<size_t>(
+                    { count - sent,
+                      GSO_MAX_SEGMENTS,
+                      static_cast<size_t>(MAX_UDP_PAYLOAD / segmentSize) });
+
+                if (segmentation && batch > 1)
+                {
+                    if (sendGso(bytes + sent * segmentSize, segmentSize, batch) >= 0)
+                    {
+                        sent += batch;
+                        continue;
+                    }
+
+                    if (errno != EIO && errno != EINVAL && errno != EOPNOTSUPP)
+                        return sent > 0 ? sent : -1;
+
+                    // Interface sem suporte a GSO (p.ex. sem checksum offload)
+                    segmentation = false;
+                }
+
+                int batchSent =
+                    sendBatch(bytes + sent * segmentSize, segmentSize, batch);
+                if (batchSent < 0)
+                    return sent > 0 ? sent : -1;
+
+                sent += batchSent;
+            }
+
+            return sent;
+        }
+
+        /**
+         * @brief Recebe um datagrama que, com GRO ligado, pode ser a concatenação de
+         *        vários datagramas do mesmo tamanho enviados pelo servidor
+         * @param segmentSize tamanho de cada datagrama agregado; igual ao retorno
+         *        quando não houve agregação
+         */
+        ssize_t receiveCoalesced(void* buffer, size_t size, uint16_t& segmentSize)
+        {
+            struct iovec  iov = { buffer, size };
+            char          control[CMSG_SPACE(sizeof(int))];
+            struct msghdr msg{};
+
+            msg.msg_name       = &server_addr;
+            msg.msg_namelen    = sizeof(server_addr);
+            msg.msg_iov        = &iov;
+            msg.msg_iovlen     = 1;
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t len = recvmsg(sockfd, &msg, 0);
+            if (len < 0)
+                return len;
+
+            server_addr_len = msg.msg_namelen;
+            segmentSize     = len;
+
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                {
+                    int gsoSize;
+                    std::memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                    segmentSize = gsoSize;
+                }
+            }
+
+            if (capture || tracer)
+            {
+                const char* bytes = static_cast<const char*>(buffer);
+                for (ssize_t offset = 0; offset < len; offset += segmentSize)
+                {
+                    recordDatagram(CAPTURE_RECEIVED,
+                                   bytes + offset,
+                                   std::min<size_t>(segmentSize, len - offset));
+                }
+            }
+
+            return len;
         }
 
     private:
+        CaptureWriter*          capture;
+        PacketTracer*           tracer;
+        bool                    segmentation = false;
+        bool                    timestamping = false;
+        uint32_t                spinBudget   = 0;
+        uint64_t                resolved_at  = 0;
+        uint64_t                ready_at     = 0;
+        PacketTimestamp         rx_timestamp;
         int                     sockfd;
         struct sockaddr_storage server_addr;
         socklen_t               server_addr_len;
+
+        ssize_t receiveFrom(void* buffer, size_t size, int flags)
+        {
+            ssize_t len;
+
+            if (timestamping)
+            {
+                struct iovec  iov = { buffer, size };
+                char          control[CMSG_SPACE(sizeof(struct timespec) * 3)];
+                struct msghdr msg{};
+
+                msg.msg_name       = &server_addr;
+                msg.msg_namelen    = sizeof(server_addr);
+                msg.msg_iov        = &iov;
+                msg.msg_iovlen     = 1;
+                msg.msg_control    = control;
+                msg.msg_controllen = sizeof(control);
+
+                len = recvmsg(sockfd, &msg, flags);
+                if (len >= 0)
+                {
+                    server_addr_len = msg.msg_namelen;
+                    rx_timestamp    = readTimestamp(msg);
+                }
+            }
+            else
+            {
+                len = recvfrom(sockfd,
+                               buffer,
+                               size,
+                               flags,
+                               (struct sockaddr*)&server_addr,
+                               &server_addr_len);
+            }
+
+            if (len > 0)
+                recordDatagram(CAPTURE_RECEIVED, buffer, len);
+
+            return len;
+        }
+
+        // Grava o datagrama na captura e no trace, quando ligados
+        void recordDatagram(CaptureDirection direction, const void* data, size_t size)
+        {
+            if (capture)
+                capture->record(direction, sockfd, data, size);
+
+            if (tracer)
+                tracer->record(direction, sockfd, data, size);
+        }
+
+        // SCM_TIMESTAMPING traz três timespec: software, (obsoleto) e hardware bruto
+        static PacketTimestamp readTimestamp(struct msghdr& msg)
+        {
+            PacketTimestamp timestamp;
+
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level != SOL_SOCKET ||
+                    cmsg->cmsg_type != SCM_TIMESTAMPING)
+                {
+                    continue;
+                }
+
+                struct timespec ts[3];
+                std::memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+
+                timestamp.software =
+                    static_cast<uint64_t>(ts[0].tv_sec) * 1000000000ULL + ts[0].tv_nsec;
+                timestamp.hardware =
+                    static_cast<uint64_t>(ts[2].tv_sec) * 1000000000ULL + ts[2].tv_nsec;
+                break;
+            }
+
+            return timestamp;
+        }
+
+        ssize_t sendGso(const char* data, uint16_t segmentSize, size_t count)
+        {
+            struct iovec  iov = { const_cast<char*>(data), segmentSize * count };
+            char          control[CMSG_SPACE(sizeof(uint16_t))] = {};
+            struct msghdr msg{};
+
+            msg.msg_name       = &server_addr;
+            msg.msg_namelen    = server_addr_len;
+            msg.msg_iov        = &iov;
+            msg.msg_iovlen     = 1;
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level     = SOL_UDP;
+            cmsg->cmsg_type      = UDP_SEGMENT;
+            cmsg->cmsg_len       = CMSG_LEN(sizeof(segmentSize));
+            std::memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+
+            return sendmsg(sockfd, &msg, 0);
+        }
+
+        int sendBatch(const char* data, uint16_t segmentSize, size_t count)
+        {
+            struct mmsghdr msgs[GSO_MAX_SEGMENTS] = {};
+            struct iovec   iovs[GSO_MAX_SEGMENTS];
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                iovs[i].iov_base            = const_cast<char*>(data + i * segmentSize);
+                iovs[i].iov_len             = segmentSize;
+                msgs[i].msg_hdr.msg_name    = &server_addr;
+                msgs[i].msg_hdr.msg_namelen = server_addr_len;
+                msgs[i].msg_hdr.msg_iov     = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen  = 1;
+            }
+
+            return sendmmsg(sockfd, msgs, count, 0);
+        }
+};
+
+/**
+ * @brief Mantém o UDP GRO ligado no socket enquanto existe. Desliga mesmo quando o
+ *        comando termina com fail(), pois no daemon o socket é reaproveitado por
+ *        comandos que usam receive, que não separa respostas agregadas
+ */
+class CoalescingGuard
+{
+    public:
+        CoalescingGuard(UdpSocket& socket)
+            : socket(socket)
+        {
+            socket.enableCoalescing();
+        }
+
+        ~CoalescingGuard()
+        {
+            socket.enableCoalescing(false);
+        }
+
+        CoalescingGuard(const CoalescingGuard&)            = delete;
+        CoalescingGuard& operator=(const CoalescingGuard&) = delete;
+
+    private:
+        UdpSocket& socket;
 };
 
 uint16_t toNetworkShort(uint16_t hostshort)
@@ -118,34 +583,34 @@ enum ErrorCode : uint16_t
     ASCII_DECODE_ERROR       = 5
 };
 
-std::string getErrorDescription(uint16_t error_code)
+const char* getErrorMessage(uint16_t error_code)
 {
     switch (error_code)
     {
         case INVALID_MESSAGE_CODE:
-            return "Erro " + std::to_string(error_code) +
-                   ": Código de mensagem inválido. O cliente enviou uma solicitação "
-                   "com um tipo desconhecido.";
+            return "Código de mensagem inválido. O cliente enviou uma solicitação com um "
+                   "tipo desconhecido.";
         case INCORRECT_MESSAGE_LENGTH:
-            return "Erro " + std::to_string(error_code) +
-                   ": Tamanho de mensagem incorreto. O cliente enviou uma solicitação "
-                   "cujo tamanho é incompatível com o tipo de solicitação.";
+            return "Tamanho de mensagem incorreto. O cliente enviou uma solicitação cujo "
+                   "tamanho é incompatível com o tipo de solicitação.";
         case INVALID_PARAMETER:
-            return "Erro " + std::to_string(error_code) +
-                   ": Parâmetro inválido. O servidor detectou um erro em um dos campos "
-                   "da solicitação.";
+            return "Parâmetro inválido. O servidor detectou um erro em um dos campos da "
+                   "solicitação.";
         case INVALID_SINGLE_TOKEN:
-            return "Erro " + std::to_string(error_code) +
-                   ": Token único inválido. Um SAS em um GAS é inválido.";
+            return "Token único inválido. Um SAS em um GAS é inválido.";
         case ASCII_DECODE_ERROR:
-            return "Erro " + std::to_string(error_code) +
-                   ": Erro de decodificação ASCII. A mensagem contém um caractere "
+            return "Erro de decodificação ASCII. A mensagem contém um caractere "
                    "não-ASCII.";
         default:
-            return "Erro " + std::to_string(error_code) + ": Erro desconhecido.";
+            return "Erro desconhecido.";
     }
 }
 
+std::string getErrorDescription(uint16_t error_code)
+{
+    return "Erro " + std::to_string(error_code) + ": " + getErrorMessage(error_code);
+}
+
 bool isValidAscii(const std::string& str)
 {
     return std::all_of(str.begin(), str.end(), [](unsigned char c) {
@@ -191,4 +656,6 @@ std::string removeSpaces(const char* charArray)
         }
     }
     return result;
-}
\ No newline at end of file
+}
+
+#endif // UTILS_H
@@ -0,0 +1,417 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "tokens.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+const char OUTPUT_ENV[] = "UDP_AUTH_OUTPUT";
+
+enum OutputFormat
+{
+    OUTPUT_TEXT,   // mesmo formato das linhas impressas pelo cliente
+    OUTPUT_CSV,    // type,id,nonce,token,status,error
+    OUTPUT_BINARY  // ResultRecord de tamanho fixo
+};
+
+/* Registro da saída binária, campos em ordem de rede como no protocolo
+
+    0       2               14              18                    82      84
+    +---+---+---+---/   /---+---+---+---+---+---+---/         /---+---+---+
+    | type  | ID            | nonce         | token               | value |
+    +---+---+---+---/   /---+---+---+---+---+---+---/         /---+---+---+
+
+    type é o tipo da resposta (2, 4, 6, 8 ou 256) e value é o status ou o código
+    de erro; campos que o tipo não possui ficam preenchidos com CLEAN_CHAR
+*/
+class ResultRecord
+{
+    public:
+        uint16_t type;
+        char     id[12];
+        uint32_t nonce;
+        char     token[64];
+        uint16_t value;
+
+        ResultRecord(uint16_t type)
+            : type(toNetworkShort(type)),
+              nonce(0),
+              value(0)
+        {
+            std::memset(id, CLEAN_CHAR, sizeof(id));
+            std::memset(token, CLEAN_CHAR, sizeof(token));
+        }
+} __attribute__((packed));
+
+OutputFormat outputFormatFromEnv()
+{
+    const char* format = std::getenv(OUTPUT_ENV);
+
+    if (format && std::strcmp(format, "csv") == 0)
+        return OUTPUT_CSV;
+
+    if (format && std::strcmp(format, "binary") == 0)
+        return OUTPUT_BINARY;
+
+    return OUTPUT_TEXT;
+}
+
+/**
+ * @brief Formata os resultados direto em blocos de memória reutilizados e os envia
+ *        ao descritor com um único writev quando todos os blocos enchem ou no flush.
+ *        Substitui o std::cout << ... << std::endl, que esvaziava o stdout a cada
+ *        linha e criava std::string temporárias
+ */
+class ResultWriter
+{
+    public:
+        static constexpr size_t CHUNK_SIZE = 64 * 1024;
+        static constexpr size_t CHUNKS     = 16;
+        static constexpr size_t MAX_FIELD  = 256; // maior trecho reservado de uma vez
+
+        ResultWriter(int fd = STDOUT_FILENO, OutputFormat format = OUTPUT_TEXT)
+            : fd(fd),
+              format(format)
+        {
+            chunks.emplace_back(new char[CHUNK_SIZE]);
+        }
+
+        ~ResultWriter()
+        {
+            flush();
+        }
+
+        void write(const IndividualTokenResponse& response)
+        {
+            if (format == OUTPUT_BINARY)
+            {
+                ResultRecord record(2);
+                std::memcpy(record.id, response.id, sizeof(record.id));
+                record.nonce = response.nonce;
+                std::memcpy(record.token, response.token, sizeof(record.token));
+                append(&record, sizeof(record));
+                return;
+            }
+
+            if (format == OUTPUT_CSV)
+                append("itr,");
+
+            appendId(response.id);
+            append(format == OUTPUT_CSV ? ',' : ':');
+            appendNumber(fromNetworkLong(response.nonce));
+            append(format == OUTPUT_CSV ? ',' : ':');
+            append(response.token, sizeof(response.token));
+
+            if (format == OUTPUT_CSV)
+                append(",,");
+
+            append('\n');
+        }
+
+        void write(const IndividualTokenStatus& status)
+        {
+            writeStatus(4, "itv", status.id, status.nonce, status.token, status.status);
+        }
+
+        void write(const GroupTokenResponse& response)
+        {
+            writeGroupToken(response.token);
+        }
+
+        // O gtv valida N membros: das colunas, só o token de grupo é preenchido
+        void write(const GroupTokenStatus& status)
+        {
+            writeStatus(8, "gtv", nullptr, 0, status.token, status.status);
+        }
+
+        void write(const ErrorResponse& error)
+        {
+            uint16_t code = fromNetworkShort(error.error);
+
+            if (format == OUTPUT_BINARY)
+            {
+                ResultRecord record(256);
+                record.value = error.error;
+                append(&record, sizeof(record));
+                return;
+            }
+
+            if (format == OUTPUT_CSV)
+            {
+                append("error,,,,,");
+                appendNumber(code);
+                append('\n');
+                return;
+            }
+
+            append("Error: Erro ");
+            appendNumber(code);
+            append(": ");
+            append(getErrorMessage(code));
+            append('\n');
+        }
+
+        /**
+         * @brief GAS montado pelo gtp; em texto sai na forma aceita pelo gtv
+         */
+        void writeGas(const std::vector<IndividualTokenResponse>& responses,
+                      const char*                                 token)
+        {
+            if (format != OUTPUT_TEXT)
+            {
+                for (const IndividualTokenResponse& response : responses)
+                    write(response);
+
+                writeGroupToken(token);
+                return;
+            }
+
+            for (const IndividualTokenResponse& response : responses)
+            {
+                appendId(response.id);
+                append(':');
+                appendNumber(fromNetworkLong(response.nonce));
+                append(':');
+                append(response.token, sizeof(response.token));
+                append('+');
+            }
+
+            append(token, 64);
+            append('\n');
+        }
+
+        // Só deve ser trocado sem conteúdo pendente, p.ex. entre comandos do daemon
+        void setFormat(OutputFormat value)
+        {
+            flush();
+            format = value;
+        }
+
+        void flush()
+        {
+            std::vector<struct iovec> iov;
+
+            for (size_t i = 0; i <= current; ++i)
+            {
+                size_t size = i < current ? used[i] : position;
+
+                if (size)
+                    iov.push_back({ chunks[i].get(), size });
+            }
+
+            // writev pode escrever só parte dos blocos (p.ex. em pipes)
+            size_t first = 0;
+            while (first < iov.size())
+            {
+                ssize_t written = writev(fd, iov.data() + first, iov.size() - first);
+
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    perror("Erro ao escrever resultado");
+                    break;
+                }
+
+                size_t remaining = written;
+                while (first < iov.size() && remaining >= iov[first].iov_len)
+                {
+                    remaining -= iov[first].iov_len;
+                    first++;
+                }
+
+                if (first < iov.size())
+                {
+                    char* base          = static_cast<char*>(iov[first].iov_base);
+                    iov[first].iov_base = base + remaining;
+                    iov[first].iov_len -= remaining;
+                }
+            }
+
+            current  = 0;
+            position = 0;
+        }
+
+    private:
+        int                                  fd;
+        OutputFormat                         format;
+        std::vector<std::unique_ptr<char[]>> chunks;
+        size_t                               used[CHUNKS] = {};
+        size_t                               current      = 0;
+        size_t                               position     = 0;
+
+        // Garante espaço contíguo para size bytes, trocando de bloco se preciso
+        char* reserve(size_t size)
+        {
+            if (position + size <= CHUNK_SIZE)
+                return chunks[current].get() + position;
+
+            // Todos os blocos cheios: um único writev e recomeça do primeiro
+            if (current + 1 == CHUNKS)
+            {
+                flush();
+                return chunks[current].get();
+            }
+
+            used[current] = position;
+            position      = 0;
+
+            if (++current == chunks.size())
+                chunks.emplace_back(new char[CHUNK_SIZE]);
+
+            return chunks[current].get();
+        }
+
+        void append(const void* data, size_t size)
+        {
+            const char* bytes = static_cast<const char*>(data);
+
+            while (size > 0)
+            {
+                size_t piece = std::min(size, MAX_FIELD);
+                std::memcpy(reserve(piece), bytes, piece);
+                position += piece;
+                bytes += piece;
+                size -= piece;
+            }
+        }
+
+        void append(const char* text)
+        {
+            append(text, std::strlen(text));
+        }
+
+        void append(char c)
+        {
+            *reserve(1) = c;
+            position++;
+        }
+
+        void appendNumber(uint64_t value)
+        {
+            char* out = reserve(20);
+            position  = std::to_chars(out, out + 20, value).ptr - chunks[current].get();
+        }
+
+        // Copia o ID de tamanho fixo sem os espaços de preenchimento
+        void appendId(const char* id)
+        {
+            char* out  = reserve(12);
+            char* next = out;
+
+            for (size_t i = 0; i < 12 && id[i] != '\0'; ++i)
+            {
+                if (id[i] != CLEAN_CHAR)
+                    *next++ = id[i];
+            }
+
+            position += next - out;
+        }
+
+        /**
+         * @brief Status de uma validação; em texto sai só o status
+         * @param id ID do SAS validado, ou nullptr se a mensagem não tem um
+         * @param nonce nonce do SAS em ordem de rede, como na mensagem
+         */
+        void writeStatus(uint16_t    type,
+                         const char* name,
+                         const char* id,
+                         uint32_t    nonce,
+                         const char* token,
+                         char        status)
+        {
+            if (format == OUTPUT_BINARY)
+            {
+                ResultRecord record(type);
+
+                if (id)
+                {
+                    std::memcpy(record.id, id, sizeof(record.id));
+                    record.nonce = nonce;
+                }
+
+                std::memcpy(record.token, token, sizeof(record.token));
+                record.value = toNetworkShort(static_cast<uint16_t>(status));
+                append(&record, sizeof(record));
+                return;
+            }
+
+            if (format == OUTPUT_CSV)
+            {
+                append(name);
+                append(',');
+
+                if (id)
+                {
+                    appendId(id);
+                    append(',');
+                    appendNumber(fromNetworkLong(nonce));
+                }
+                else
+                {
+                    append(',');
+                }
+
+                append(',');
+                append(token, 64);
+                append(',');
+            }
+
+            // Em texto o status sai como inteiro, como no operator<< das mensagens
+            int value = static_cast<int>(status);
+            if (value < 0)
+            {
+                append('-');
+                value = -value;
+            }
+            appendNumber(value);
+
+            if (format == OUTPUT_CSV)
+                append(',');
+
+            append('\n');
+        }
+
+        void writeGroupToken(const char* token)
+        {
+            if (format == OUTPUT_BINARY)
+            {
+                ResultRecord record(6);
+                std::memcpy(record.token, token, sizeof(record.token));
+                append(&record, sizeof(record));
+                return;
+            }
+
+            if (format == OUTPUT_CSV)
+                append("gtr,,,");
+
+            append(token, 64);
+
+            if (format == OUTPUT_CSV)
+                append(",,");
+
+            append('\n');
+        }
+};
+
+/**
+ * @brief Writer da saída padrão no formato de UDP_AUTH_OUTPUT. Como é estático, o
+ *        conteúdo pendente é escrito também quando o cliente termina com exit()
+ */
+ResultWriter& resultWriter()
+{
+    static ResultWriter writer(STDOUT_FILENO, outputFormatFromEnv());
+    return writer;
+}
+
+#endif // WRITER_H
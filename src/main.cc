@@ -1,204 +1,802 @@
+#include "alloc.h"
+#include "daemon.h"
+#include "demux.h"
+#include "hedge.h"
 #include "tokens.h"
+#include "writer.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <netinet/in.h>
+#include <poll.h>
 #include <string>
 #include <unistd.h>
 
-bool isPacketError(char* buffer, ssize_t packetSize)
+const char BUSY_POLL_ENV[] = "UDP_AUTH_BUSY_POLL";
+
+/**
+ * @brief Aplica as opções de socket pedidas pelo ambiente: receive de baixa latência
+ *        com UDP_AUTH_BUSY_POLL=<spin>[:<cpu>] e SO_TIMESTAMPING com UDP_AUTH_TIMING
+ */
+void configureSocket(UdpSocket& socket, LatencyTrace& trace)
+{
+    trace.mark(MARK_RESOLVED, socket.resolvedAt());
+    trace.mark(MARK_SOCKET_READY, socket.readyAt());
+
+    if (timingEnabled() && !socket.enableTimestamping())
+    {
+        std::cerr << "Aviso: SO_TIMESTAMPING não suportado; sem estágios do kernel"
+                  << std::endl;
+    }
+
+    const char* config = std::getenv(BUSY_POLL_ENV);
+
+    if (!config || !*config)
+        return;
+
+    uint32_t    spin      = strtoul(config, nullptr, 10);
+    const char* separator = strchr(config, ':');
+    int         cpu       = separator ? atoi(separator + 1) : -1;
+
+    if (!socket.enableBusyPoll(spin, cpu))
+    {
+        std::cerr << "Aviso: SO_BUSY_POLL ou afinidade de CPU não aplicados; "
+                     "usando apenas o spin"
+                  << std::endl;
+    }
+}
+
+using SocketCache =
+    std::map<std::pair<std::string, uint16_t>, std::unique_ptr<UdpSocket>>;
+
+// Sockets abertos pelos comandos do processo, por host:port
+SocketCache& clientSockets()
+{
+    static SocketCache sockets;
+    return sockets;
+}
+
+/**
+ * @brief Socket para host:port, criado e configurado no primeiro uso e reaproveitado
+ *        pelos comandos seguintes do mesmo processo (ver --daemon)
+ */
+UdpSocket& clientSocket(const char* host, uint16_t port, LatencyTrace& trace)
+{
+    std::unique_ptr<UdpSocket>& socket = clientSockets()[{ host, port }];
+
+    if (!socket)
+    {
+        socket = std::make_unique<UdpSocket>(host, port);
+        configureSocket(*socket, trace);
+        return *socket;
+    }
+
+    // Respostas atrasadas de um comando anterior; um ErrorResponse não tem eco e
+    // seria atribuído à requisição deste
+    socket->discardPending();
+
+    // Reaproveitado: resolução e criação do socket não custam nada
+    trace.mark(MARK_RESOLVED);
+    trace.mark(MARK_SOCKET_READY);
+
+    return *socket;
+}
+
+/**
+ * @brief Registra os timestamps de envio que ainda não foram marcados. Marcas só
+ *        quando o timestamp existe: mark(..., 0) usaria o instante atual
+ */
+void markSendTimestamp(LatencyTrace& trace, const PacketTimestamp& sentAt)
 {
-    if (packetSize == sizeof(ErrorResponse))
+    if (sentAt.software && !trace.marks[MARK_KERNEL_TX])
+        trace.mark(MARK_KERNEL_TX, sentAt.software);
+
+    if (sentAt.hardware && !trace.marks[MARK_NIC_TX])
+        trace.mark(MARK_NIC_TX, sentAt.hardware);
+}
+
+/**
+ * @brief Espera a resposta de uma requisição idempotente. Se ela não chega até o
+ *        percentil de RTT da política de hedge, envia uma cópia (ao alvo de hedge,
+ *        se configurado) e fica com a primeira resposta que chegar. A outra é
+ *        descartada: a da cópia com o socket dela, a do original pelo próximo
+ *        comando que reaproveitar o socket
+ * @return socket com um datagrama pronto, ou nullptr se o timeout expirou
+ */
+UdpSocket* waitHedged(UdpSocket& socket, HedgedRequest& hedge, LatencyTrace& trace)
+{
+    HedgePolicy&   policy   = hedgePolicy();
+    const uint64_t deadline = hedge.sentAt + DEFAULT_TIMEOUT * 1000000000ULL;
+    const uint64_t delay    = policy.delayNs(hedge.type);
+
+    // Sem histórico suficiente não há hedge
+    hedge.decided = hedge.decided || !delay;
+
+    while (true)
     {
-        ErrorResponse* error_response = reinterpret_cast<ErrorResponse*>(buffer);
+        uint64_t now    = monotonicNs();
+        uint64_t wakeAt = hedge.decided ? deadline : hedge.sentAt + delay;
+
+        if (now >= deadline)
+            return nullptr;
 
-        if (fromNetworkShort(error_response->type) == 256)
+        if (!hedge.decided && now >= wakeAt)
         {
-            std::cout << *error_response << std::endl;
+            hedge.decided = true;
+
+            if (policy.tryHedge(hedge.type))
+            {
+                // A cópia não entra nos estágios de latência nem usa os sockets
+                // reaproveitados (ver HedgedRequest)
+                hedge.duplicate =
+                    policy.targetHost.empty()
+                        ? std::make_unique<UdpSocket>(hedge.host, hedge.port)
+                        : std::make_unique<UdpSocket>(policy.targetHost.c_str(),
+                                                      policy.targetPort);
+
+                if (hedge.duplicate->send(hedge.packet, hedge.size) < 0)
+                {
+                    perror("Erro ao enviar mensagem");
+                    fail();
+                }
+            }
+            continue;
         }
-        else
+
+        UdpSocket*    sockets[2] = { &socket, hedge.duplicate.get() };
+        struct pollfd fds[2]     = { { socket.fd(), POLLIN, 0 },
+                                     { hedge.duplicate ? hedge.duplicate->fd() : -1,
+                                       POLLIN,
+                                       0 } };
+        nfds_t        count      = hedge.duplicate ? 2 : 1;
+        int           timeout = (wakeAt - now + 999999) / 1000000;
+
+        if (poll(fds, count, timeout) < 0 && errno != EINTR)
         {
-            std::cerr << "Erro desconhecido" << std::endl;
+            perror("Erro ao aguardar resposta");
+            fail();
         }
-        return true;
-    }
 
-    return false;
+        for (nfds_t i = 0; i < count; ++i)
+        {
+            if (fds[i].revents & POLLIN)
+                return sockets[i];
+
+            // Com SO_TIMESTAMPING o timestamp de envio na fila de erros também acorda
+            // o poll; ele é lido aqui para não manter o poll acordado
+            if (fds[i].revents & POLLERR)
+            {
+                PacketTimestamp sentAt = sockets[i]->sendTimestamp();
+
+                if (!sentAt.software && !sentAt.hardware)
+                    return sockets[i]; // erro de verdade: receive o reporta
+
+                if (i == 0)
+                    markSendTimestamp(trace, sentAt);
+            }
+        }
+    }
 }
 
-void sendIndividualTokenRequest(const char* host,
-                                uint16_t    port,
-                                const char* id,
-                                uint32_t    nonce)
+/**
+ * @brief Recebe a resposta de uma requisição registrada no demux; com hedge, a
+ *        requisição pode ser duplicada enquanto a resposta não chega
+ * @return true se a resposta corresponde a uma requisição e não é um erro
+ */
+bool receiveReply(UdpSocket&     socket,
+                  ResponseDemux& demux,
+                  char*          buffer,
+                  size_t         size,
+                  Datagram&      reply,
+                  LatencyTrace&  trace,
+                  ResultWriter&  out,
+                  HedgedRequest* hedge = nullptr)
 {
-    UdpSocket socket(host, port);
+    InFlightRequest request;
+    DemuxStatus     status;
+    UdpSocket*      from       = &socket;
+    uint64_t        receivedAt = 0; // monotonicNs(), como o envio do hedge
 
-    IndividualTokenRequest request(id, nonce);
-    if (socket.send(&request, sizeof(request)) < 0)
+    if (hedge)
+        hedgePolicy().countRequest(hedge->type);
+
+    // Num socket reaproveitado pode chegar antes a resposta atrasada de um comando
+    // anterior, que não corresponde a nenhuma requisição deste
+    do
     {
-        perror("Erro ao enviar mensagem");
-        exit(EXIT_FAILURE);
+        if (hedge && !(from = waitHedged(socket, *hedge, trace)))
+        {
+            errno = EAGAIN; // o mesmo erro do timeout do socket
+            perror("Erro ao receber resposta");
+            fail();
+        }
+
+        ssize_t recv_len = from->receive(buffer, size);
+        trace.mark(MARK_RECEIVED);
+        receivedAt = monotonicNs();
+
+        if (recv_len < 0)
+        {
+            perror("Erro ao receber resposta");
+            fail();
+        }
+
+        status = demux.dispatch(buffer, recv_len, reply, request);
+    } while (status == DEMUX_UNMATCHED);
+    trace.mark(MARK_DECODED);
+
+    if (hedge && status == DEMUX_OK)
+    {
+        hedgePolicy().recordRtt(hedge->type, receivedAt - hedge->sentAt);
+
+        if (hedge->duplicate)
+            hedgePolicy().countHedgedReply(hedge->type);
+    }
+
+    // Com hedge, o timestamp de envio pode já ter sido lido por waitHedged. O de
+    // hardware da recepção só vale contra o do envio quando ambos vêm do mesmo
+    // socket, e portanto do mesmo relógio de NIC
+    if (timingEnabled())
+    {
+        PacketTimestamp receivedAt = from->receiveTimestamp();
+        markSendTimestamp(trace, socket.sendTimestamp());
+
+        if (receivedAt.software)
+            trace.mark(MARK_KERNEL_RX, receivedAt.software);
+
+        if (receivedAt.hardware && from == &socket)
+            trace.mark(MARK_NIC_RX, receivedAt.hardware);
+
+        latencyProfile().record(trace);
+    }
+
+    if (status != DEMUX_OK)
+    {
+        std::cerr << describeDemuxStatus(status) << std::endl;
+        return false;
+    }
+
+    if (reply.layout->type == ERROR_RESPONSE_TYPE)
+    {
+        out.write(*reinterpret_cast<const ErrorResponse*>(buffer));
+        return false;
     }
 
-    char buffer[BUF_SIZE];
-    std::memset(buffer, CLEAN_CHAR, sizeof(buffer));
-    ssize_t recv_len = socket.receive(buffer, sizeof(IndividualTokenResponse));
+    return true;
+}
+
+void sendIndividualTokenRequest(const char*   host,
+                                uint16_t      port,
+                                const char*   id,
+                                uint32_t      nonce,
+                                ResultWriter& out)
+{
+    LatencyTrace trace;
+    trace.mark(MARK_START);
 
-    if (recv_len < 0)
+    UdpSocket&    socket = clientSocket(host, port, trace);
+    ResponseDemux demux;
+
+    // A própria mensagem já é o formato de envio
+    IndividualTokenRequest request(id, nonce);
+    trace.mark(MARK_PARSED);
+    demux.track(reinterpret_cast<const char*>(&request), sizeof(request));
+    trace.mark(MARK_SERIALIZED);
+
+    if (socket.send(&request, sizeof(request)) < 0)
     {
-        perror("Erro ao receber resposta");
-        exit(EXIT_FAILURE);
+        perror("Erro ao enviar mensagem");
+        fail();
     }
+    trace.mark(MARK_SENT);
 
-    IndividualTokenResponse response;
-    std::memcpy(&response, buffer, sizeof(IndividualTokenResponse));
+    char     buffer[BUF_SIZE];
+    Datagram reply;
 
-    if (!isPacketError(buffer, recv_len))
+    if (receiveReply(socket, demux, buffer, sizeof(buffer), reply, trace, out))
     {
-        std::cout << response << std::endl;
+        out.write(*reinterpret_cast<const IndividualTokenResponse*>(reply.data));
     }
 }
 
-void sendIndividualTokenValidation(const char* host, uint16_t port, const char* sas)
+void sendIndividualTokenValidation(const char*   host,
+                                   uint16_t      port,
+                                   const char*   sas,
+                                   ResultWriter& out)
 {
-    UdpSocket socket(host, port);
+    LatencyTrace trace;
+    trace.mark(MARK_START);
+
+    UdpSocket&    socket = clientSocket(host, port, trace);
+    ResponseDemux demux;
 
     IndividualTokenValidation validation =
         parseIndividualTokenValidationFromString(sas);
+    trace.mark(MARK_PARSED);
 
     char serializedValidation[sizeof(validation)];
     validation.serialize(serializedValidation);
+    demux.track(serializedValidation, sizeof(validation));
+    trace.mark(MARK_SERIALIZED);
 
     if (socket.send(serializedValidation, sizeof(validation)) < 0)
     {
         perror("Erro ao enviar mensagem");
-        exit(EXIT_FAILURE);
+        fail();
     }
+    trace.mark(MARK_SENT);
+
+    // Validações são idempotentes e podem ser duplicadas (ver hedge.h)
+    char          buffer[BUF_SIZE];
+    Datagram      reply;
+    HedgedRequest hedge(
+        serializedValidation, sizeof(validation), host, port, monotonicNs());
+
+    if (receiveReply(socket,
+                     demux,
+                     buffer,
+                     sizeof(buffer),
+                     reply,
+                     trace,
+                     out,
+                     hedgePolicy().enabled() ? &hedge : nullptr))
+    {
+        out.write(*reinterpret_cast<const IndividualTokenStatus*>(reply.data));
+    }
+}
 
-    char buffer[BUF_SIZE];
-    std::memset(buffer, CLEAN_CHAR, sizeof(IndividualTokenStatus));
-    ssize_t recv_len = socket.receive(buffer, sizeof(IndividualTokenStatus));
+void sendGroupTokenRequest(const char*       host,
+                           uint16_t          port,
+                           std::vector<SAS>& sas,
+                           ResultWriter&     out)
+{
+    LatencyTrace trace;
+    trace.mark(MARK_START);
+
+    UdpSocket&    socket = clientSocket(host, port, trace);
+    ResponseDemux demux;
+
+    GroupTokenRequest request(sas);
+    trace.mark(MARK_PARSED);
 
-    if (recv_len < 0)
+    // vector e não new[]: no daemon fail() lança exceção e o buffer vazaria
+    std::vector<char> serializedRequest(request.packetSize());
+    request.serialize(serializedRequest.data());
+    demux.track(serializedRequest.data(), serializedRequest.size());
+    trace.mark(MARK_SERIALIZED);
+
+    if (socket.send(serializedRequest.data(), serializedRequest.size()) < 0)
     {
-        perror("Erro ao receber resposta");
-        exit(EXIT_FAILURE);
+        perror("Erro ao enviar mensagem");
+        fail();
     }
+    trace.mark(MARK_SENT);
 
-    IndividualTokenStatus status;
-    std::memcpy(&status, buffer, sizeof(IndividualTokenStatus));
+    // A resposta repete os N SAS, então pode ocupar o datagrama inteiro
+    static char buffer[MAX_DATAGRAM];
+    Datagram    reply;
 
-    if (!isPacketError(buffer, recv_len))
+    if (receiveReply(socket, demux, buffer, sizeof(buffer), reply, trace, out))
     {
-        std::cout << status << std::endl;
+        out.write(GroupTokenResponse(reply.data));
     }
 }
 
-void sendGroupTokenRequest(const char* host, uint16_t port, std::vector<SAS>& sas)
+void sendGroupTokenValidation(const char*   host,
+                              uint16_t      port,
+                              const char*   sas,
+                              ResultWriter& out)
 {
-    UdpSocket socket(host, port);
+    LatencyTrace trace;
+    trace.mark(MARK_START);
 
-    GroupTokenRequest request(sas);
-    char*             serializedRequest = new char[request.packetSize()];
-    request.serialize(serializedRequest);
+    UdpSocket&    socket = clientSocket(host, port, trace);
+    ResponseDemux demux;
+
+    GroupTokenValidation validation = parseGroupTokenValidationFromString(sas);
+    trace.mark(MARK_PARSED);
+
+    std::vector<char> serializedValidation(validation.packetSize(), CLEAN_CHAR);
+    validation.serialize(serializedValidation.data());
+    demux.track(serializedValidation.data(), serializedValidation.size());
+    trace.mark(MARK_SERIALIZED);
 
-    if (socket.send(serializedRequest, request.packetSize()) < 0)
+    if (socket.send(serializedValidation.data(), serializedValidation.size()) < 0)
     {
         perror("Erro ao enviar mensagem");
-        exit(EXIT_FAILURE);
+        fail();
     }
+    trace.mark(MARK_SENT);
+
+    static char   buffer[MAX_DATAGRAM];
+    Datagram      reply;
+    HedgedRequest hedge(serializedValidation.data(),
+                        serializedValidation.size(),
+                        host,
+                        port,
+                        monotonicNs());
+
+    if (receiveReply(socket,
+                     demux,
+                     buffer,
+                     sizeof(buffer),
+                     reply,
+                     trace,
+                     out,
+                     hedgePolicy().enabled() ? &hedge : nullptr))
+    {
+        out.write(GroupTokenStatus(reply.data));
+    }
+}
 
-    char buffer[BUF_SIZE];
-    std::memset(buffer, CLEAN_CHAR, sizeof(buffer));
-    ssize_t recv_len = socket.receive(buffer, BUF_SIZE);
+using GroupMembers = std::vector<std::pair<std::string, uint32_t>>;
+
+/**
+ * @brief Envia um datagrama e aguarda a resposta correspondente, retransmitindo
+ *        quando o timeout do socket expira
+ */
+bool exchange(UdpSocket&     socket,
+              ResponseDemux& demux,
+              const char*    packet,
+              size_t         size,
+              char*          buffer,
+              size_t         bufferSize,
+              Datagram&      reply,
+              ResultWriter&  out)
+{
+    demux.track(packet, size);
 
-    if (recv_len < 0)
+    for (uint16_t attempt = 0; attempt < MAX_RETRIES; ++attempt)
     {
-        perror("Erro ao receber resposta");
-        exit(EXIT_FAILURE);
+        if (socket.send(packet, size) < 0)
+        {
+            perror("Erro ao enviar mensagem");
+            fail();
+        }
+
+        while (true)
+        {
+            ssize_t recv_len = socket.receive(buffer, bufferSize);
+            int     error    = errno;
+
+            // Timestamps de envio de UDP_AUTH_TIMING, que o gtp não usa
+            socket.sendTimestamp();
+            errno = error;
+
+            if (recv_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            if (recv_len < 0)
+            {
+                perror("Erro ao receber resposta");
+                fail();
+            }
+
+            InFlightRequest request;
+            DemuxStatus     status = demux.dispatch(buffer, recv_len, reply, request);
+
+            // Resposta duplicada de uma retransmissão anterior
+            if (status == DEMUX_UNMATCHED)
+                continue;
+
+            if (status != DEMUX_OK)
+            {
+                std::cerr << describeDemuxStatus(status) << std::endl;
+                return false;
+            }
+
+            if (reply.layout->type == ERROR_RESPONSE_TYPE)
+            {
+                out.write(*reinterpret_cast<const ErrorResponse*>(buffer));
+                return false;
+            }
+
+            return true;
+        }
     }
 
-    if (!isPacketError(buffer, recv_len))
+    std::cerr << "Sem resposta do servidor" << std::endl;
+    return false;
+}
+
+// Fan-out das itr do gtp: no máximo um lote GSO em voo, completado conforme as
+// respostas chegam. O intervalo de retransmissão de cada requisição dobra a cada
+// tentativa, até DEFAULT_TIMEOUT
+const size_t   FANOUT_WINDOW        = GSO_MAX_SEGMENTS;
+const uint64_t FANOUT_RETRANSMIT_NS = 50000000ULL; // 50 ms
+const uint16_t FANOUT_MAX_ATTEMPTS  = 8;
+
+/**
+ * @brief Envia as itr mantendo até FANOUT_WINDOW em voo e recebe as respostas em
+ *        responses. Cada requisição sem resposta é retransmitida pelo seu próprio
+ *        timer, independente do timeout do socket
+ * @param buffer buffer de recepção com MAX_DATAGRAM bytes
+ * @return número de requisições que ficaram sem resposta
+ */
+size_t issueIndividualTokens(UdpSocket&                            socket,
+                             ResponseDemux&                        demux,
+                             std::vector<IndividualTokenRequest>&  requests,
+                             std::vector<IndividualTokenResponse>& responses,
+                             char*                                 buffer,
+                             ResultWriter&                         out)
+{
+    const size_t          total = requests.size();
+    std::vector<bool>     answered(total, false);
+    std::vector<uint16_t> attempts(total, 0);
+    std::vector<uint64_t> resendAt(total, 0); // monotonicNs()
+    size_t                remaining = total;
+    size_t                inFlight  = 0;
+    size_t                oldest    = 0; // primeira ainda sem resposta
+    size_t                next      = 0; // primeira ainda não enviada
+
+    // Os envios novos saem em lote (UDP GSO quando disponível); o GRO fica ligado
+    // só até a última resposta das itr
+    socket.enableSegmentation();
+    CoalescingGuard coalescing(socket);
+
+    while (remaining > 0)
     {
-        std::cout << getGroupTokenResponse(buffer, request) << std::endl;
+        uint64_t now   = monotonicNs();
+        size_t   batch = std::min(FANOUT_WINDOW - inFlight, total - next);
+
+        if (batch > 0)
+        {
+            if (socket.sendSegmented(
+                    &requests[next], sizeof(IndividualTokenRequest), batch) < 0)
+            {
+                perror("Erro ao enviar mensagem");
+                fail();
+            }
+
+            for (size_t i = next; i < next + batch; ++i)
+            {
+                attempts[i] = 1;
+                resendAt[i] = now + FANOUT_RETRANSMIT_NS;
+            }
+            next += batch;
+            inFlight += batch;
+        }
+
+        while (oldest < next && answered[oldest])
+            oldest++;
+
+        // Retransmite as vencidas e acha o próximo timer
+        uint64_t wakeAt = UINT64_MAX;
+
+        for (size_t i = oldest; i < next; ++i)
+        {
+            if (answered[i])
+                continue;
+
+            if (resendAt[i] <= now)
+            {
+                if (attempts[i] == FANOUT_MAX_ATTEMPTS)
+                    return remaining;
+
+                if (socket.send(&requests[i], sizeof(requests[i])) < 0)
+                {
+                    perror("Erro ao enviar mensagem");
+                    fail();
+                }
+
+                resendAt[i] =
+                    now + std::min<uint64_t>(FANOUT_RETRANSMIT_NS << attempts[i],
+                                             DEFAULT_TIMEOUT * 1000000000ULL);
+                attempts[i]++;
+            }
+
+            wakeAt = std::min(wakeAt, resendAt[i]);
+        }
+
+        struct pollfd pfd     = { socket.fd(), POLLIN, 0 };
+        int           timeout = (wakeAt - now + 999999) / 1000000;
+
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+        {
+            perror("Erro ao aguardar resposta");
+            fail();
+        }
+
+        // Com SO_TIMESTAMPING cada envio deixa um timestamp na fila de erros, que
+        // acorda o poll e ocupa o buffer de recepção. O gtp não os usa: são
+        // descartados a cada volta
+        if (pfd.revents & POLLERR)
+        {
+            PacketTimestamp sentAt = socket.sendTimestamp();
+
+            if (!(pfd.revents & POLLIN) && (sentAt.software || sentAt.hardware))
+                continue;
+        }
+        else if (!(pfd.revents & POLLIN))
+        {
+            continue;
+        }
+
+        uint16_t segmentSize;
+        ssize_t  recv_len = socket.receiveCoalesced(buffer, MAX_DATAGRAM, segmentSize);
+
+        if (recv_len < 0)
+        {
+            perror("Erro ao receber resposta");
+            fail();
+        }
+
+        // Com GRO, um único recvmsg pode trazer várias respostas concatenadas
+        for (ssize_t offset = 0; offset < recv_len; offset += segmentSize)
+        {
+            const char* segment = buffer + offset;
+            size_t      len     = std::min<size_t>(segmentSize, recv_len - offset);
+
+            Datagram        reply;
+            InFlightRequest request;
+            DemuxStatus     status = demux.dispatch(segment, len, reply, request);
+
+            // Inclui a segunda resposta de uma requisição retransmitida
+            if (status == DEMUX_UNMATCHED)
+                continue;
+
+            if (status != DEMUX_OK)
+            {
+                std::cerr << describeDemuxStatus(status) << std::endl;
+                fail();
+            }
+
+            if (reply.layout->type == ERROR_RESPONSE_TYPE)
+            {
+                out.write(*reinterpret_cast<const ErrorResponse*>(segment));
+                fail();
+            }
+
+            auto* response = static_cast<IndividualTokenResponse*>(request.context);
+            std::memcpy(response, reply.data, sizeof(IndividualTokenResponse));
+            answered[response - responses.data()] = true;
+            remaining--;
+            inFlight--;
+        }
     }
-    delete[] serializedRequest;
+
+    return remaining;
 }
 
-void sendGroupTokenValidation(const char* host, uint16_t port, const char* sas)
+/**
+ * @brief Emite os tokens individuais de todos os membros em paralelo, monta o GAS em
+ *        memória e então solicita e valida o token de grupo, tudo no mesmo socket
+ */
+void runGroupTokenPipeline(const char*         host,
+                           uint16_t            port,
+                           const GroupMembers& members,
+                           ResultWriter&       out)
 {
-    UdpSocket socket(host, port);
+    LatencyTrace trace;
+    trace.mark(MARK_START);
 
-    GroupTokenValidation validation = parseGroupTokenValidationFromString(sas);
+    UdpSocket&    socket = clientSocket(host, port, trace);
+    ResponseDemux demux;
 
-    char* serializedValidation = new char[validation.packetSize()];
-    std::memset(serializedValidation, CLEAN_CHAR, validation.packetSize());
+    std::vector<IndividualTokenRequest>  requests;
+    std::vector<IndividualTokenResponse> responses(members.size());
 
-    validation.serialize(serializedValidation);
+    requests.reserve(members.size());
+    for (const auto& [id, nonce] : members)
+    {
+        requests.emplace_back(id, nonce);
+    }
 
-    if (socket.send(serializedValidation, validation.packetSize()) < 0)
+    for (size_t i = 0; i < requests.size(); ++i)
     {
-        perror("Erro ao enviar mensagem");
-        exit(EXIT_FAILURE);
+        demux.track(reinterpret_cast<const char*>(&requests[i]),
+                    sizeof(IndividualTokenRequest),
+                    &responses[i]);
     }
 
-    char buffer[BUF_SIZE];
-    std::memset(buffer, CLEAN_CHAR, sizeof(buffer));
-    ssize_t recv_len = socket.receive(buffer, BUF_SIZE);
+    static char buffer[MAX_DATAGRAM];
+    size_t      remaining =
+        issueIndividualTokens(socket, demux, requests, responses, buffer, out);
 
-    if (recv_len < 0)
+    if (remaining > 0)
     {
-        perror("Erro ao receber resposta");
-        exit(EXIT_FAILURE);
+        std::cerr << "Sem resposta do servidor para " << remaining
+                  << " token(s) individual(is)" << std::endl;
+        fail();
     }
 
-    int status = getGroupTokenStatus(buffer, validation);
+    std::vector<SAS> gas(responses.begin(), responses.end());
+
+    GroupTokenRequest groupRequest(gas);
+    std::vector<char> serializedRequest(groupRequest.packetSize());
+    groupRequest.serialize(serializedRequest.data());
 
-    if (!isPacketError(buffer, recv_len))
+    Datagram reply;
+
+    if (!exchange(socket,
+                  demux,
+                  serializedRequest.data(),
+                  serializedRequest.size(),
+                  buffer,
+                  sizeof(buffer),
+                  reply,
+                  out))
+    {
+        fail();
+    }
+
+    GroupTokenResponse   groupResponse(reply.data);
+    std::string          token(groupResponse.token, 64);
+    GroupTokenValidation validation(gas, token);
+    std::vector<char>    serializedValidation(validation.packetSize());
+    validation.serialize(serializedValidation.data());
+
+    if (!exchange(socket,
+                  demux,
+                  serializedValidation.data(),
+                  serializedValidation.size(),
+                  buffer,
+                  sizeof(buffer),
+                  reply,
+                  out))
     {
-        std::cout << status << std::endl;
+        fail();
     }
 
-    delete[] serializedValidation;
+    // No gtp só os estágios de preparação e o total fazem sentido por requisição
+    trace.mark(MARK_DECODED);
+    if (timingEnabled())
+        latencyProfile().record(trace);
+
+    out.writeGas(responses, token.data());
+    out.write(GroupTokenStatus(reply.data));
 }
 
-int main(int argc, char* argv[])
+/**
+ * @brief Executa um comando da linha de comando. Erros terminam o processo com
+ *        fail(), que no daemon vira uma CommandFailure
+ */
+int runCommand(int argc, char* argv[])
 {
     if (argc < 4)
     {
-        std::cerr << "Uso: ./client <host> <port> <command>" << std::endl;
-        exit(EXIT_FAILURE);
+        std::cerr << "Uso: ./client <host> <port> <command>" << std::endl
+                  << "     ./client --daemon [socket]" << std::endl;
+        fail();
     }
 
     const char* host    = argv[1];
     uint16_t    port    = atoi(argv[2]);
     const char* command = argv[3];
 
+    AllocationSnapshot allocationsBefore;
+    if (allocationTracking)
+        allocationsBefore = AllocationSnapshot::begin();
+
     if (strcmp(command, "itr") == 0)
     {
         if (argc != 6)
         {
             std::cerr << "Uso para itr: ./client <host> <port> itr <id> <nonce>"
                       << std::endl;
-            exit(EXIT_FAILURE);
+            fail();
         }
 
         const char* id    = argv[4];
         uint32_t    nonce = atoi(argv[5]);
-        sendIndividualTokenRequest(host, port, id, nonce);
+        sendIndividualTokenRequest(host, port, id, nonce, resultWriter());
     }
     else if (strcmp(command, "itv") == 0)
     {
         if (argc != 5)
         {
             std::cerr << "Uso para itv: ./client <host> <port> itv <SAS>" << std::endl;
-            exit(EXIT_FAILURE);
+            fail();
         }
 
         const char* sas = argv[4];
-        sendIndividualTokenValidation(host, port, sas);
+        sendIndividualTokenValidation(host, port, sas, resultWriter());
     }
     else if (strcmp(command, "gtr") == 0)
     {
@@ -207,17 +805,24 @@ int main(int argc, char* argv[])
             std::cerr << "Uso para gtr: ./client <host> <port> gtr N <SAS-1> <SAS-2> "
                          "... <SAS-N>"
                       << std::endl;
-            exit(EXIT_FAILURE);
+            fail();
         }
 
-        uint16_t n = atoi(argv[4]);
+        int n = atoi(argv[4]);
+
+        if (n > MAX_GROUP_SIZE)
+        {
+            std::cerr << "Grupo com mais de " << MAX_GROUP_SIZE
+                      << " SAS não cabe em um datagrama" << std::endl;
+            fail();
+        }
 
         if (argc != 5 + n)
         {
             std::cerr << "Uso para gtr: ./client <host> <port> gtr N <SAS-1> <SAS-2> "
                          "... <SAS-N>"
                       << std::endl;
-            exit(EXIT_FAILURE);
+            fail();
         }
 
         std::vector<SAS> gas;
@@ -228,24 +833,163 @@ int main(int argc, char* argv[])
             gas.emplace_back(argv[5 + i]);
         }
 
-        sendGroupTokenRequest(host, port, gas);
+        sendGroupTokenRequest(host, port, gas, resultWriter());
     }
     else if (strcmp(command, "gtv") == 0)
     {
         if (argc != 5)
         {
             std::cerr << "Uso para gtv: ./client <host> <port> gtv <GAS>" << std::endl;
-            exit(EXIT_FAILURE);
+            fail();
         }
 
+        // Um SAS antes de cada '+', e o token no fim
         const char* sas = argv[4];
-        sendGroupTokenValidation(host, port, sas);
+
+        if (std::count(sas, sas + strlen(sas), '+') > MAX_GROUP_SIZE)
+        {
+            std::cerr << "Grupo com mais de " << MAX_GROUP_SIZE
+                      << " SAS não cabe em um datagrama" << std::endl;
+            fail();
+        }
+
+        sendGroupTokenValidation(host, port, sas, resultWriter());
+    }
+    else if (strcmp(command, "gtp") == 0)
+    {
+        if (argc < 5)
+        {
+            std::cerr << "Uso para gtp: ./client <host> <port> gtp <id-1>:<nonce-1> "
+                         "... <id-N>:<nonce-N>"
+                      << std::endl;
+            fail();
+        }
+
+        if (argc - 4 > MAX_GROUP_SIZE)
+        {
+            std::cerr << "Grupo com mais de " << MAX_GROUP_SIZE
+                      << " membros não cabe em um datagrama" << std::endl;
+            fail();
+        }
+
+        GroupMembers members;
+        members.reserve(argc - 4);
+
+        for (int i = 4; i < argc; ++i)
+        {
+            const char* separator = strchr(argv[i], ':');
+
+            if (!separator)
+            {
+                std::cerr << "Membro inválido (esperado <id>:<nonce>): " << argv[i]
+                          << std::endl;
+                fail();
+            }
+
+            members.emplace_back(std::string(argv[i], separator - argv[i]),
+                                 atoi(separator + 1));
+        }
+
+        runGroupTokenPipeline(host, port, members, resultWriter());
     }
     else
     {
         std::cerr << "Comando inválido" << std::endl;
-        exit(EXIT_FAILURE);
+        fail();
+    }
+
+    if (allocationTracking)
+    {
+        allocationProfile().record(command, allocationsBefore);
+        std::cerr << titleOutput("Allocations") << std::endl;
+        allocationProfile().report(std::cerr);
+    }
+
+    if (timingEnabled())
+    {
+        std::cerr << titleOutput("Latency breakdown") << std::endl;
+        latencyProfile().report(std::cerr);
+
+        if (hedgePolicy().enabled())
+        {
+            std::cerr << titleOutput("Hedging") << std::endl;
+            hedgePolicy().report(std::cerr);
+        }
     }
 
     return EXIT_SUCCESS;
 }
+
+/**
+ * @brief Diz se o ambiente pede alguma configuração que o processo lê uma única vez
+ *        (socket, captura, trace, hedge, alocações ou relatório de latência). O
+ *        daemon já fixou as suas, então esses comandos rodam localmente
+ */
+bool hasProcessSettings()
+{
+    const char* const settings[] = {
+        TIMING_ENV,    CAPTURE_ENV, TRACE_ENV,        TRACE_FORMAT_ENV,
+        BUSY_POLL_ENV, HEDGE_ENV,   HEDGE_TARGET_ENV, ALLOC_ENV,
+    };
+
+    for (const char* name : settings)
+    {
+        const char* value = std::getenv(name);
+
+        if (value && *value)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief runCommand no daemon. Um comando que falhou pode ter deixado requisições
+ *        sem resposta nos sockets reaproveitados: eles são fechados, e os próximos
+ *        comandos abrem sockets novos
+ */
+int runDaemonCommand(int argc, char* argv[])
+{
+    try
+    {
+        int status = runCommand(argc, argv);
+
+        if (status != EXIT_SUCCESS)
+            clientSockets().clear();
+
+        return status;
+    }
+    catch (...)
+    {
+        clientSockets().clear();
+        throw;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Processo residente: comandos de outros clientes rodam aqui, sem pagar de novo
+    // a inicialização do processo, a resolução do endereço e a criação do socket
+    if (argc >= 2 && strcmp(argv[1], "--daemon") == 0)
+    {
+        return runDaemon(argc > 2 ? argv[2] : daemonSocketPath(), runDaemonCommand);
+    }
+
+    // Só UDP_AUTH_OUTPUT segue com o comando; as demais configurações não
+    int status;
+    if (!hasProcessSettings() &&
+        forwardToDaemon(daemonSocketPath(), argc, argv, status))
+    {
+        return status;
+    }
+
+    // Um comando avulso nunca junta as HEDGE_MIN_SAMPLES respostas do hedge
+    if (hedgePolicy().enabled())
+    {
+        std::cerr << "Aviso: " << HEDGE_ENV << " só tem efeito em um daemon iniciado "
+                  << "com ele (--daemon), após " << HEDGE_MIN_SAMPLES << " respostas"
+                  << std::endl;
+    }
+
+    return runCommand(argc, argv);
+}
@@ -0,0 +1,183 @@
+#include "tokens.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Benchmark de loopback do receive de baixa latência: mede o RTT de itv contra um
+ * servidor de eco local com o receive bloqueante e com busy-poll
+ *
+ * Uso: ./busy_poll_bench [round trips] [spin] [cpu do cliente] [cpu do servidor]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+class EchoServer
+{
+    public:
+        EchoServer(int cpu)
+        {
+            sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+            struct timeval timeout = { 0, 100000 };
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            struct sockaddr_in addr{};
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port        = 0;
+
+            socklen_t len = sizeof(addr);
+            if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+                getsockname(sockfd, (struct sockaddr*)&addr, &len) < 0)
+            {
+                perror("Erro ao criar servidor de eco");
+                exit(EXIT_FAILURE);
+            }
+
+            port   = fromNetworkShort(addr.sin_port);
+            worker = std::thread(&EchoServer::run, this, cpu);
+        }
+
+        ~EchoServer()
+        {
+            stopping = true;
+            worker.join();
+            close(sockfd);
+        }
+
+        uint16_t port;
+
+    private:
+        int               sockfd;
+        std::thread       worker;
+        std::atomic<bool> stopping{ false };
+
+        // Responde cada itv com um IndividualTokenStatus válido; os dois layouts
+        // coincidem até o token, então a requisição é lida direto na resposta
+        void run(int cpu)
+        {
+            if (cpu >= 0)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(cpu, &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            }
+
+            IndividualTokenStatus status;
+            status.status = 1;
+
+            while (!stopping)
+            {
+                struct sockaddr_storage client;
+                socklen_t               clientLen = sizeof(client);
+
+                ssize_t len = recvfrom(sockfd,
+                                       &status,
+                                       sizeof(IndividualTokenValidation),
+                                       0,
+                                       (struct sockaddr*)&client,
+                                       &clientLen);
+                if (len < 0)
+                    continue;
+
+                status.type = toNetworkShort(4);
+                sendto(sockfd,
+                       &status,
+                       sizeof(status),
+                       0,
+                       (struct sockaddr*)&client,
+                       clientLen);
+            }
+        }
+};
+
+double percentile(std::vector<double>& values, double p)
+{
+    // Todas as idas e voltas perdidas
+    if (values.empty())
+        return 0;
+
+    size_t index = static_cast<size_t>(p * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+void runBench(const char* name,
+              size_t      roundTrips,
+              uint32_t    spin,
+              int         cpu,
+              int         serverCpu)
+{
+    EchoServer server(serverCpu);
+    UdpSocket  socket("127.0.0.1", server.port);
+
+    if (spin > 0 && !socket.enableBusyPoll(spin, cpu))
+    {
+        std::cerr << "Aviso: SO_BUSY_POLL ou afinidade de CPU não aplicados"
+                  << std::endl;
+    }
+
+    IndividualTokenValidation validation("bench", 1, std::string(64, 'a'));
+    char                      serialized[sizeof(validation)];
+    char                      buffer[BUF_SIZE];
+    std::vector<double>       rtts;
+
+    validation.serialize(serialized);
+    rtts.reserve(roundTrips);
+
+    // Aquecimento
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        socket.send(serialized, sizeof(serialized));
+        socket.receive(buffer, sizeof(buffer));
+    }
+
+    for (size_t i = 0; i < roundTrips; ++i)
+    {
+        Clock::time_point start = Clock::now();
+
+        socket.send(serialized, sizeof(serialized));
+        if (socket.receive(buffer, sizeof(buffer)) < 0)
+            continue;
+
+        rtts.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start)
+                           .count());
+    }
+
+    double p50  = percentile(rtts, 0.50);
+    double p99  = percentile(rtts, 0.99);
+    double p999 = percentile(rtts, 0.999);
+
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << p50 << std::setw(10) << p99
+              << std::setw(10) << p999 << std::setw(10) << roundTrips - rtts.size()
+              << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t   roundTrips = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50000;
+    uint32_t spin       = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+    int      cpu        = argc > 3 ? atoi(argv[3]) : -1;
+    int      serverCpu  = argc > 4 ? atoi(argv[4]) : -1;
+
+    std::cout << titleOutput("Busy-poll loopback (itv)") << std::endl;
+    std::cout << std::left << std::setw(12) << "modo" << std::right << std::setw(10)
+              << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p999 us"
+              << std::setw(10) << "perdas" << std::endl;
+
+    runBench("bloqueante", roundTrips, 0, -1, serverCpu);
+    runBench("busy-poll", roundTrips, spin, cpu, serverCpu);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+#include "tokens.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Benchmark de loopback do envio em lote: compara sendto por datagrama, sendmmsg
+ * (fallback de sendSegmented) e UDP GSO, com o receptor usando UDP GRO quando o
+ * kernel suporta
+ */
+
+using Clock = std::chrono::steady_clock;
+
+const size_t BENCH_PACKETS = 200000;
+const size_t BENCH_BATCH   = GSO_MAX_SEGMENTS;
+
+enum SendMode
+{
+    SEND_SENDTO,
+    SEND_SENDMMSG,
+    SEND_GSO
+};
+
+class LoopbackReceiver
+{
+    public:
+        LoopbackReceiver()
+        {
+            sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+            int rcvbuf = 32 << 20;
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+            int on    = 1;
+            coalesced = setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+
+            struct timeval timeout = { 0, 200000 };
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            struct sockaddr_in addr{};
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port        = 0;
+
+            socklen_t len = sizeof(addr);
+            if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+                getsockname(sockfd, (struct sockaddr*)&addr, &len) < 0)
+            {
+                perror("Erro ao criar receptor");
+                exit(EXIT_FAILURE);
+            }
+
+            port   = fromNetworkShort(addr.sin_port);
+            worker = std::thread(&LoopbackReceiver::run, this);
+        }
+
+        ~LoopbackReceiver()
+        {
+            if (worker.joinable())
+                worker.join();
+            close(sockfd);
+        }
+
+        // Aguarda o receptor esvaziar o socket e devolve quantos datagramas chegaram
+        size_t finish()
+        {
+            stopping = true;
+            worker.join();
+            return received;
+        }
+
+        uint16_t port;
+        bool     coalesced;
+
+    private:
+        int                 sockfd;
+        std::thread         worker;
+        std::atomic<bool>   stopping{ false };
+        std::atomic<size_t> received{ 0 };
+
+        void run()
+        {
+            static thread_local char buffer[MAX_DATAGRAM];
+            char                     control[CMSG_SPACE(sizeof(int))];
+
+            while (true)
+            {
+                struct iovec  iov = { buffer, sizeof(buffer) };
+                struct msghdr msg{};
+                msg.msg_iov        = &iov;
+                msg.msg_iovlen     = 1;
+                msg.msg_control    = control;
+                msg.msg_controllen = sizeof(control);
+
+                ssize_t len = recvmsg(sockfd, &msg, 0);
+                if (len < 0)
+                {
+                    if (stopping)
+                        return;
+                    continue;
+                }
+
+                size_t segmentSize = len;
+                for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(&msg, cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    {
+                        int gsoSize;
+                        std::memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                        segmentSize = gsoSize;
+                    }
+                }
+
+                received += (len + segmentSize - 1) / segmentSize;
+            }
+        }
+};
+
+const char* modeName(SendMode mode)
+{
+    switch (mode)
+    {
+        case SEND_SENDTO:
+            return "sendto";
+        case SEND_SENDMMSG:
+            return "sendmmsg";
+        case SEND_GSO:
+            return "gso";
+        default:
+            return "?";
+    }
+}
+
+/**
+ * @brief Envia BENCH_PACKETS datagramas de size bytes e retorna pacotes por segundo
+ */
+double runBench(SendMode mode, const std::vector<char>& packets, size_t size)
+{
+    LoopbackReceiver receiver;
+    UdpSocket        socket("127.0.0.1", receiver.port);
+
+    if (mode == SEND_GSO && !socket.enableSegmentation())
+    {
+        std::cout << std::left << std::setw(10) << modeName(mode) << std::right
+                  << std::setw(6) << size << "  UDP_SEGMENT não suportado" << std::endl;
+        receiver.finish();
+        return 0;
+    }
+
+    Clock::time_point start = Clock::now();
+
+    for (size_t sent = 0; sent < BENCH_PACKETS; sent += BENCH_BATCH)
+    {
+        if (mode == SEND_SENDTO)
+        {
+            for (size_t i = 0; i < BENCH_BATCH; ++i)
+                socket.send(packets.data() + i * size, size);
+        }
+        else
+        {
+            socket.sendSegmented(packets.data(), size, BENCH_BATCH);
+        }
+    }
+
+    double seconds  = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t received = receiver.finish();
+    double pps      = BENCH_PACKETS / seconds;
+
+    std::cout << std::left << std::setw(10) << modeName(mode) << std::right
+              << std::setw(6) << size << std::setw(14) << static_cast<uint64_t>(pps)
+              << std::setw(12) << received << std::setw(8)
+              << (receiver.coalesced ? "sim" : "não") << std::endl;
+
+    return pps;
+}
+
+template<typename Message>
+void benchMessage(const Message& message)
+{
+    std::vector<char> packets(sizeof(Message) * BENCH_BATCH);
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i)
+        std::memcpy(packets.data() + i * sizeof(Message), &message, sizeof(Message));
+
+    double base = runBench(SEND_SENDTO, packets, sizeof(Message));
+    double mmsg = runBench(SEND_SENDMMSG, packets, sizeof(Message));
+    double gso  = runBench(SEND_GSO, packets, sizeof(Message));
+
+    std::cout << std::fixed << std::setprecision(2) << "ganho sobre sendto: sendmmsg "
+              << mmsg / base << "x, gso " << gso / base << "x" << std::endl;
+}
+
+int main()
+{
+    std::cout << titleOutput("UDP GSO/GRO loopback") << std::endl;
+    std::cout << std::left << std::setw(10) << "modo" << std::right << std::setw(6)
+              << "bytes" << std::setw(14) << "pacotes/s" << std::setw(12)
+              << "recebidos" << std::setw(8) << "gro" << std::endl;
+
+    benchMessage(IndividualTokenRequest("bench", 1));
+    benchMessage(IndividualTokenValidation("bench", 1, std::string(64, 'a')));
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+#include "alloc.h"
+#include "tokens.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Microbenchmarks da codificação e decodificação das mensagens de tokens.h, com
+ * grupos de 1 a 800 SAS. Cada linha da saída é um objeto JSON:
+ *
+ *   {"name":"gtr_serialize","n":100,"iterations":...,"ns_per_op":...,
+ *    "bytes_per_op":...,"allocs_per_op":...,"alloc_bytes_per_op":...}
+ *
+ * bytes_per_op é o tamanho da mensagem (ou do texto) processada em uma operação,
+ * para que regressões apareçam tanto em ns/op quanto em ns/byte; allocs_per_op e
+ * alloc_bytes_per_op vêm do contador de alocações (alloc.h)
+ *
+ * Uso: ./micro_bench [tempo mínimo por benchmark em ms] [filtro de nome]
+ */
+
+using Clock = std::chrono::steady_clock;
+
+const uint16_t GROUP_SIZES[] = { 1, 2, 10, 50, 100, 200, 400, 800 };
+
+// Impede que o compilador descarte o resultado de uma operação medida
+template <typename T> inline void keep(T&& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class MicroBench
+{
+    public:
+        MicroBench(double minMs, const char* filter)
+            : minNs(minMs * 1e6),
+              filter(filter)
+        { }
+
+        /**
+         * @brief Mede body dobrando o número de iterações até o tempo mínimo
+         */
+        template <typename Body>
+        void run(const char* name, uint16_t n, size_t bytesPerOp, Body&& body)
+        {
+            if (filter && !std::strstr(name, filter))
+                return;
+
+            for (size_t i = 0; i < 16; ++i) // aquecimento
+                body();
+
+            size_t             iterations = 1;
+            double             elapsed    = 0;
+            AllocationCounters before;
+
+            while (true)
+            {
+                before                  = threadAllocations;
+                Clock::time_point start = Clock::now();
+
+                for (size_t i = 0; i < iterations; ++i)
+                    body();
+
+                elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                              .count();
+
+                if (elapsed >= minNs)
+                    break;
+
+                iterations *= 2;
+            }
+
+            AllocationCounters after = threadAllocations;
+
+            std::cout << "{\"name\":\"" << name << "\",\"n\":" << n
+                      << ",\"iterations\":" << iterations
+                      << ",\"ns_per_op\":" << elapsed / iterations
+                      << ",\"bytes_per_op\":" << bytesPerOp << ",\"allocs_per_op\":"
+                      << static_cast<double>(after.allocations - before.allocations) /
+                             iterations
+                      << ",\"alloc_bytes_per_op\":"
+                      << static_cast<double>(after.bytes - before.bytes) / iterations
+                      << "}" << std::endl;
+        }
+
+    private:
+        double      minNs;
+        const char* filter;
+};
+
+std::string makeId(size_t i)
+{
+    return "user" + std::to_string(i);
+}
+
+std::string makeToken(size_t i)
+{
+    std::string token(64, 'a');
+    std::string suffix = std::to_string(i);
+    token.replace(64 - suffix.size(), suffix.size(), suffix);
+    return token;
+}
+
+std::string makeSas(size_t i)
+{
+    return makeId(i) + ":" + std::to_string(i) + ":" + makeToken(i);
+}
+
+void benchIndividual(MicroBench& bench)
+{
+    const std::string id    = makeId(1);
+    const std::string token = makeToken(1);
+    const std::string sas   = makeSas(1);
+    const char        paddedId[13] = "user1       ";
+
+    bench.run("itr_construct", 1, sizeof(IndividualTokenRequest), [&]() {
+        IndividualTokenRequest request(id, 1);
+        keep(request);
+    });
+
+    bench.run("itv_construct", 1, sizeof(IndividualTokenValidation), [&]() {
+        IndividualTokenValidation validation(id, 1, token);
+        keep(validation);
+    });
+
+    IndividualTokenValidation validation(id, 1, token);
+    char                      serialized[sizeof(IndividualTokenValidation)];
+
+    bench.run("itv_serialize", 1, sizeof(serialized), [&]() {
+        validation.serialize(serialized);
+        keep(serialized);
+    });
+
+    bench.run("itv_parse", 1, sas.size(), [&]() {
+        IndividualTokenValidation parsed =
+            parseIndividualTokenValidationFromString(sas.c_str());
+        keep(parsed);
+    });
+
+    bench.run("sas_parse", 1, sas.size(), [&]() {
+        SAS parsed(sas);
+        keep(parsed);
+    });
+
+    bench.run("remove_spaces", 1, sizeof(paddedId) - 1, [&]() {
+        std::string clean = removeSpaces(paddedId);
+        keep(clean);
+    });
+
+    bench.run("is_valid_ascii", 1, sas.size(), [&]() {
+        bool valid = isValidAscii(sas);
+        keep(valid);
+    });
+}
+
+void benchGroup(MicroBench& bench, uint16_t n)
+{
+    std::vector<std::string> sasText;
+    std::vector<SAS>         gas;
+    std::string              allSas;
+    size_t                   sasBytes = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        sasText.push_back(makeSas(i));
+        gas.emplace_back(sasText.back());
+        sasBytes += sasText.back().size();
+        allSas += sasText.back() + "+";
+    }
+
+    const std::string token = makeToken(n);
+    allSas += token;
+
+    bench.run("sas_parse_group", n, sasBytes, [&]() {
+        std::vector<SAS> parsed;
+        parsed.reserve(n);
+
+        for (const std::string& text : sasText)
+            parsed.emplace_back(text);
+
+        keep(parsed);
+    });
+
+    GroupTokenRequest request(gas);
+    std::vector<char> serializedRequest(request.packetSize());
+
+    bench.run("gtr_construct", n, request.packetSize(), [&]() {
+        GroupTokenRequest constructed(gas);
+        keep(constructed);
+    });
+
+    bench.run("gtr_serialize", n, request.packetSize(), [&]() {
+        request.serialize(serializedRequest.data());
+        keep(serializedRequest);
+    });
+
+    GroupTokenValidation validation(gas, token);
+    std::vector<char>    serializedValidation(validation.packetSize());
+
+    bench.run("gtv_construct", n, validation.packetSize(), [&]() {
+        GroupTokenValidation constructed(gas, token);
+        keep(constructed);
+    });
+
+    bench.run("gtv_serialize", n, validation.packetSize(), [&]() {
+        validation.serialize(serializedValidation.data());
+        keep(serializedValidation);
+    });
+
+    bench.run("gtv_parse", n, allSas.size(), [&]() {
+        GroupTokenValidation parsed =
+            parseGroupTokenValidationFromString(allSas.c_str());
+        keep(parsed);
+    });
+
+    // Respostas montadas a partir das requisições: o servidor repete os SAS e
+    // acrescenta o token (e o status, no gtv)
+    std::vector<char> response(request.packetSize() + 64, CLEAN_CHAR);
+    request.serialize(response.data());
+    std::memcpy(response.data() + request.packetSize(), token.data(), 64);
+
+    bench.run("gtr_response", n, response.size(), [&]() {
+        std::string groupToken = getGroupTokenResponse(response.data(), request);
+        keep(groupToken);
+    });
+
+    std::vector<char> status(validation.packetSize() + 1, 1);
+    validation.serialize(status.data());
+
+    bench.run("gtv_status", n, status.size(), [&]() {
+        int value = getGroupTokenStatus(status.data(), validation);
+        keep(value);
+    });
+
+    bench.run("is_valid_ascii_gas", n, allSas.size(), [&]() {
+        bool valid = isValidAscii(allSas);
+        keep(valid);
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    double      minMs  = argc > 1 ? atof(argv[1]) : 200;
+    const char* filter = argc > 2 ? argv[2] : nullptr;
+
+    if (minMs <= 0)
+    {
+        std::cerr << "Uso: ./micro_bench [tempo mínimo em ms] [filtro]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    allocationTracking = true;
+    MicroBench bench(minMs, filter);
+
+    benchIndividual(bench);
+
+    for (uint16_t n : GROUP_SIZES)
+        benchGroup(bench, n);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+#include "demux.h"
+#include "tokens.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Testes de unidade do classificador e do demultiplexador de respostas (demux.h):
+ * tamanhos esperados de cada layout, pareamento pelo eco da requisição e
+ * atribuição de ErrorResponse. Termina com falha se algum teste falhar
+ */
+
+size_t failures = 0;
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": falhou: " #condition       \
+                      << std::endl;                                                   \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+/**
+ * @brief Monta um datagrama: o tipo em ordem de rede seguido de body
+ */
+std::vector<char> makePacket(uint16_t type, const std::string& body)
+{
+    std::vector<char> packet(sizeof(type) + body.size());
+    uint16_t          networkType = toNetworkShort(type);
+
+    std::memcpy(packet.data(), &networkType, sizeof(networkType));
+    std::memcpy(packet.data() + sizeof(type), body.data(), body.size());
+
+    return packet;
+}
+
+// Mensagem de grupo: tipo, N e bytes de conteúdo
+std::vector<char> makeCounted(uint16_t type, uint16_t n, size_t bytes, char fill)
+{
+    std::string body(sizeof(n) + bytes, fill);
+    uint16_t    networkN = toNetworkShort(n);
+
+    std::memcpy(body.data(), &networkN, sizeof(networkN));
+    return makePacket(type, body);
+}
+
+DemuxStatus classify(const std::vector<char>& packet)
+{
+    Datagram datagram;
+    return classifyDatagram(packet.data(), packet.size(), datagram);
+}
+
+void testLengths()
+{
+    // Curto demais para o tipo, ou para o N de um layout contado
+    CHECK(classify({}) == DEMUX_TOO_SHORT);
+    CHECK(classify({ 0 }) == DEMUX_TOO_SHORT);
+    CHECK(classify(makePacket(6, "x")) == DEMUX_TOO_SHORT);
+
+    CHECK(classify(makePacket(0, "")) == DEMUX_UNKNOWN_TYPE);
+    CHECK(classify(makePacket(9, std::string(80, 'x'))) == DEMUX_UNKNOWN_TYPE);
+    CHECK(classify(makePacket(255, "")) == DEMUX_UNKNOWN_TYPE);
+
+    // Tamanhos fixos
+    CHECK(classify(makePacket(1, std::string(16, 'x'))) == DEMUX_OK);
+    CHECK(classify(makePacket(2, std::string(80, 'x'))) == DEMUX_OK);
+    CHECK(classify(makePacket(2, std::string(81, 'x'))) == DEMUX_BAD_LENGTH);
+    CHECK(classify(makePacket(4, std::string(81, 'x'))) == DEMUX_OK);
+    CHECK(classify(makePacket(ERROR_RESPONSE_TYPE, "xx")) == DEMUX_OK);
+    CHECK(classify(makePacket(ERROR_RESPONSE_TYPE, "x")) == DEMUX_BAD_LENGTH);
+
+    // gtr: 4+80N; resposta 4+80N+64; gtv: 68+80N; resposta 69+80N
+    for (uint16_t n : { 0, 1, 3, 800 })
+    {
+        Datagram          datagram;
+        std::vector<char> reply = makeCounted(6, n, 80 * n + 64, 'x');
+
+        CHECK(classifyDatagram(reply.data(), reply.size(), datagram) == DEMUX_OK);
+        CHECK(datagram.n == n);
+        CHECK(datagram.size == 4 + 80u * n + 64);
+
+        CHECK(classify(makeCounted(5, n, 80 * n, 'x')) == DEMUX_OK);
+        CHECK(classify(makeCounted(7, n, 80 * n + 64, 'x')) == DEMUX_OK);
+        CHECK(classify(makeCounted(8, n, 80 * n + 65, 'x')) == DEMUX_OK);
+
+        CHECK(classify(makeCounted(6, n, 80 * n + 63, 'x')) == DEMUX_BAD_LENGTH);
+        CHECK(classify(makeCounted(6, n, 80 * n + 65, 'x')) == DEMUX_BAD_LENGTH);
+        CHECK(classify(makeCounted(8, n, 80 * n + 64, 'x')) == DEMUX_BAD_LENGTH);
+        CHECK(classify(makeCounted(8, n + 1, 80 * n + 65, 'x')) == DEMUX_BAD_LENGTH);
+    }
+}
+
+// Resposta de um itr: repete ID e nonce e acrescenta o token
+std::vector<char> itrReply(const std::vector<char>& request)
+{
+    return makePacket(2,
+                      std::string(request.begin() + 2, request.end()) +
+                          std::string(64, 't'));
+}
+
+void testEchoMatching()
+{
+    ResponseDemux     demux;
+    std::vector<char> first  = makePacket(1, "alice       0001");
+    std::vector<char> second = makePacket(1, "bob         0002");
+    int               firstContext, secondContext;
+
+    demux.track(first.data(), first.size(), &firstContext);
+    demux.track(second.data(), second.size(), &secondContext);
+    CHECK(demux.pending() == 2);
+
+    Datagram          reply;
+    InFlightRequest   request;
+    std::vector<char> secondReply = itrReply(second);
+    std::vector<char> firstReply  = itrReply(first);
+
+    // Fora de ordem: cada resposta vai para a sua requisição
+    CHECK(demux.dispatch(secondReply.data(), secondReply.size(), reply, request) ==
+          DEMUX_OK);
+    CHECK(request.context == &secondContext);
+    CHECK(reply.layout->type == 2);
+
+    // Resposta repetida não tem mais requisição pendente
+    CHECK(demux.dispatch(secondReply.data(), secondReply.size(), reply, request) ==
+          DEMUX_UNMATCHED);
+
+    // Eco que não corresponde a nada, e uma requisição recebida como resposta
+    std::vector<char> stranger = itrReply(makePacket(1, "carol       0003"));
+    CHECK(demux.dispatch(stranger.data(), stranger.size(), reply, request) ==
+          DEMUX_UNMATCHED);
+    CHECK(demux.dispatch(first.data(), first.size(), reply, request) ==
+          DEMUX_UNMATCHED);
+
+    CHECK(demux.dispatch(firstReply.data(), firstReply.size(), reply, request) ==
+          DEMUX_OK);
+    CHECK(request.context == &firstContext);
+    CHECK(demux.pending() == 0);
+}
+
+void testDuplicates()
+{
+    ResponseDemux     demux;
+    std::vector<char> request = makePacket(3, std::string(80, 'v'));
+
+    // Retransmissão: a mesma requisição em voo duas vezes
+    demux.track(request.data(), request.size());
+    demux.track(request.data(), request.size());
+
+    Datagram          reply;
+    InFlightRequest   matched;
+    std::vector<char> status = makePacket(4, std::string(80, 'v') + "\x01");
+
+    CHECK(demux.dispatch(status.data(), status.size(), reply, matched) == DEMUX_OK);
+    CHECK(demux.dispatch(status.data(), status.size(), reply, matched) == DEMUX_OK);
+    CHECK(demux.dispatch(status.data(), status.size(), reply, matched) ==
+          DEMUX_UNMATCHED);
+
+    // Resposta de grupo: o eco inclui N e os SAS, mas não o token
+    std::vector<char> gtr = makeCounted(5, 2, 160, 's');
+    std::vector<char> gtrReply(gtr);
+    gtrReply[1] = 6;
+    gtrReply.insert(gtrReply.end(), 64, 't');
+
+    std::vector<char> otherGtr = makeCounted(5, 2, 160, 'z');
+    demux.track(otherGtr.data(), otherGtr.size());
+    demux.track(gtr.data(), gtr.size());
+
+    CHECK(demux.dispatch(gtrReply.data(), gtrReply.size(), reply, matched) ==
+          DEMUX_OK);
+    CHECK(matched.packet == gtr.data());
+    CHECK(demux.pending() == 1);
+}
+
+void testErrorRouting()
+{
+    ResponseDemux     demux;
+    std::vector<char> first  = makePacket(1, "alice       0001");
+    std::vector<char> second = makePacket(3, std::string(80, 'v'));
+    std::vector<char> error =
+        makePacket(ERROR_RESPONSE_TYPE, std::string("\x00\x02", 2));
+    int               firstContext, secondContext;
+
+    Datagram        reply;
+    InFlightRequest request;
+
+    // Sem requisição pendente, o erro não é de ninguém
+    CHECK(demux.dispatch(error.data(), error.size(), reply, request) ==
+          DEMUX_UNMATCHED);
+
+    demux.track(first.data(), first.size(), &firstContext);
+    demux.track(second.data(), second.size(), &secondContext);
+
+    // ErrorResponse não carrega eco: vai para a requisição pendente mais antiga
+    CHECK(demux.dispatch(error.data(), error.size(), reply, request) == DEMUX_OK);
+    CHECK(reply.layout->type == ERROR_RESPONSE_TYPE);
+    CHECK(request.context == &firstContext);
+
+    CHECK(demux.dispatch(error.data(), error.size(), reply, request) == DEMUX_OK);
+    CHECK(request.context == &secondContext);
+
+    CHECK(demux.dispatch(error.data(), error.size(), reply, request) ==
+          DEMUX_UNMATCHED);
+
+    // Datagramas inválidos não consomem requisições
+    demux.track(first.data(), first.size(), &firstContext);
+    std::vector<char> truncated = makePacket(2, std::string(40, 'x'));
+    CHECK(demux.dispatch(truncated.data(), truncated.size(), reply, request) ==
+          DEMUX_BAD_LENGTH);
+    CHECK(demux.pending() == 1);
+}
+
+int main()
+{
+    testLengths();
+    testEchoMatching();
+    testDuplicates();
+    testErrorRouting();
+
+    if (failures)
+    {
+        std::cerr << failures << " verificação(ões) falharam" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "OK" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+#include "tokens.h"
+#include "writer.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+/*
+ * Testes de unidade do ResultWriter (writer.h): os bytes exatos de cada tipo de
+ * mensagem nos formatos texto, CSV e binário. Termina com falha se algum teste
+ * falhar
+ */
+
+size_t failures = 0;
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": falhou: " #condition       \
+                      << std::endl;                                                   \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+const std::string SAS_TOKEN(64, 's');
+const std::string GROUP_TOKEN(64, 'g');
+
+/**
+ * @brief Bytes escritos por um ResultWriter no formato dado, lidos de um pipe
+ */
+std::string capture(OutputFormat format, const std::function<void(ResultWriter&)>& write)
+{
+    int fds[2];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    {
+        ResultWriter writer(fds[1], format);
+        write(writer);
+    } // o destrutor faz o flush
+    close(fds[1]);
+
+    std::string output;
+    char        buffer[4096];
+    ssize_t     len;
+
+    while ((len = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, len);
+
+    close(fds[0]);
+    return output;
+}
+
+// ResultRecord montado byte a byte: type, ID, nonce, token e value
+std::string record(const std::string& type,
+                   const std::string& id,
+                   const std::string& nonce,
+                   const std::string& token,
+                   const std::string& value)
+{
+    return type + id + std::string(12 - id.size(), CLEAN_CHAR) + nonce + token + value;
+}
+
+// gtr (6) ou gtv (8) com um membro; o gtv termina com o status
+std::string groupPacket(uint16_t type, char status)
+{
+    std::string packet = std::string("\x00", 1) + static_cast<char>(type) +
+                         std::string("\x00\x01", 2) + "bob" +
+                         std::string(9, CLEAN_CHAR) + std::string("\x00\x00\x00\x02", 4) +
+                         SAS_TOKEN + GROUP_TOKEN;
+
+    if (type == 8)
+        packet += status;
+
+    return packet;
+}
+
+void testIndividualTokenResponse()
+{
+    IndividualTokenResponse response("alice", 7, SAS_TOKEN);
+    auto write = [&](ResultWriter& out) { out.write(response); };
+
+    CHECK(capture(OUTPUT_TEXT, write) == "alice:7:" + SAS_TOKEN + "\n");
+    CHECK(capture(OUTPUT_CSV, write) == "itr,alice,7," + SAS_TOKEN + ",,\n");
+    CHECK(capture(OUTPUT_BINARY, write) ==
+          record(std::string("\x00\x02", 2),
+                 "alice",
+                 std::string("\x00\x00\x00\x07", 4),
+                 SAS_TOKEN,
+                 std::string("\x00\x00", 2)));
+}
+
+void testIndividualTokenStatus()
+{
+    IndividualTokenStatus status("alice", 7, SAS_TOKEN, 1);
+    auto write = [&](ResultWriter& out) { out.write(status); };
+
+    CHECK(capture(OUTPUT_TEXT, write) == "1\n");
+    CHECK(capture(OUTPUT_CSV, write) == "itv,alice,7," + SAS_TOKEN + ",1,\n");
+    CHECK(capture(OUTPUT_BINARY, write) ==
+          record(std::string("\x00\x04", 2),
+                 "alice",
+                 std::string("\x00\x00\x00\x07", 4),
+                 SAS_TOKEN,
+                 std::string("\x00\x01", 2)));
+}
+
+void testGroupTokenResponse()
+{
+    std::string        packet = groupPacket(6, 0);
+    GroupTokenResponse response(packet.data());
+    auto write = [&](ResultWriter& out) { out.write(response); };
+
+    CHECK(capture(OUTPUT_TEXT, write) == GROUP_TOKEN + "\n");
+    CHECK(capture(OUTPUT_CSV, write) == "gtr,,," + GROUP_TOKEN + ",,\n");
+    CHECK(capture(OUTPUT_BINARY, write) ==
+          record(std::string("\x00\x06", 2),
+                 "",
+                 std::string(4, '\0'),
+                 GROUP_TOKEN,
+                 std::string("\x00\x00", 2)));
+}
+
+void testGroupTokenStatus()
+{
+    std::string      packet = groupPacket(8, 0);
+    GroupTokenStatus status(packet.data());
+    auto write = [&](ResultWriter& out) { out.write(status); };
+
+    CHECK(capture(OUTPUT_TEXT, write) == "0\n");
+    CHECK(capture(OUTPUT_CSV, write) == "gtv,,," + GROUP_TOKEN + ",0,\n");
+    CHECK(capture(OUTPUT_BINARY, write) ==
+          record(std::string("\x00\x08", 2),
+                 "",
+                 std::string(4, '\0'),
+                 GROUP_TOKEN,
+                 std::string("\x00\x00", 2)));
+}
+
+void testErrorResponse()
+{
+    ErrorResponse error(2);
+    auto write = [&](ResultWriter& out) { out.write(error); };
+
+    CHECK(capture(OUTPUT_TEXT, write) ==
+          std::string("Error: Erro 2: ") + getErrorMessage(2) + "\n");
+    CHECK(capture(OUTPUT_CSV, write) == "error,,,,,2\n");
+    CHECK(capture(OUTPUT_BINARY, write) ==
+          record(std::string("\x01\x00", 2),
+                 "",
+                 std::string(4, '\0'),
+                 std::string(64, CLEAN_CHAR),
+                 std::string("\x00\x02", 2)));
+}
+
+void testGas()
+{
+    std::vector<IndividualTokenResponse> responses = {
+        IndividualTokenResponse("alice", 7, SAS_TOKEN),
+        IndividualTokenResponse("bob", 2, SAS_TOKEN)
+    };
+    auto write = [&](ResultWriter& out) { out.writeGas(responses, GROUP_TOKEN.data()); };
+
+    // Em texto, a mesma forma aceita pelo gtv
+    CHECK(capture(OUTPUT_TEXT, write) == "alice:7:" + SAS_TOKEN + "+bob:2:" +
+                                             SAS_TOKEN + "+" + GROUP_TOKEN + "\n");
+    CHECK(capture(OUTPUT_CSV, write) == "itr,alice,7," + SAS_TOKEN + ",,\n" +
+                                            "itr,bob,2," + SAS_TOKEN + ",,\n" +
+                                            "gtr,,," + GROUP_TOKEN + ",,\n");
+    CHECK(capture(OUTPUT_BINARY, write).size() == 3 * sizeof(ResultRecord));
+}
+
+int main()
+{
+    CHECK(sizeof(ResultRecord) == 84);
+
+    testIndividualTokenResponse();
+    testIndividualTokenStatus();
+    testGroupTokenResponse();
+    testGroupTokenStatus();
+    testErrorResponse();
+    testGas();
+
+    if (failures)
+    {
+        std::cerr << failures << " verificação(ões) falharam" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "OK" << std::endl;
+    return EXIT_SUCCESS;
+}
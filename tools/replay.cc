@@ -0,0 +1,377 @@
+#include "demux.h"
+#include "tokens.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+class ReplayRequest
+{
+    public:
+        const CapturedDatagram* datagram;
+        size_t                  stream;
+        uint16_t                type;
+        double                  capturedRtt; // ms, negativo se não houve resposta
+        Clock::time_point       sentAt{};
+        bool                    answered = false;
+};
+
+/**
+ * @brief Socket de um stream da captura durante o replay. As respostas são pareadas
+ *        com as requisições pelo ResponseDemux (eco dos bytes da requisição), então
+ *        respostas fora de ordem, retransmissões e cópias de hedge não trocam de
+ *        requisição; sent guarda a ordem de envio para o timeout
+ */
+class ReplayStream
+{
+    public:
+        std::unique_ptr<UdpSocket> socket;
+        ResponseDemux              demux;
+        std::deque<ReplayRequest*> sent;
+        size_t                     pending = 0;
+
+        // Requisição mais antiga ainda sem resposta, ou nullptr
+        ReplayRequest* oldest()
+        {
+            while (!sent.empty() && sent.front()->answered)
+                sent.pop_front();
+
+            return sent.empty() ? nullptr : sent.front();
+        }
+};
+
+class ReplayStats
+{
+    public:
+        std::vector<double> captured;
+        std::vector<double> replayed;
+        size_t              sent   = 0;
+        size_t              lost   = 0;
+        size_t              errors = 0;
+};
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1));
+    return values[index];
+}
+
+double elapsedMs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void printReport(const std::map<uint16_t, ReplayStats>& stats)
+{
+    std::cout << titleOutput("Replay") << std::endl;
+    std::cout << std::left << std::setw(5) << "type" << std::right << std::setw(8)
+              << "sent" << std::setw(7) << "lost" << std::setw(7) << "errors"
+              << std::setw(12) << "cap p50" << std::setw(12) << "rep p50"
+              << std::setw(12) << "cap p99" << std::setw(12) << "rep p99"
+              << std::setw(12) << "d p50" << std::setw(12) << "d p99" << std::endl;
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& [type, s] : stats)
+    {
+        double capP50 = percentile(s.captured, 0.50);
+        double capP99 = percentile(s.captured, 0.99);
+        double repP50 = percentile(s.replayed, 0.50);
+        double repP99 = percentile(s.replayed, 0.99);
+
+        std::cout << std::left << std::setw(5) << findLayout(type)->name << std::right
+                  << std::setw(8) << s.sent << std::setw(7) << s.lost << std::setw(7)
+                  << s.errors << std::setw(12) << capP50 << std::setw(12) << repP50
+                  << std::setw(12) << capP99 << std::setw(12) << repP99
+                  << std::setw(12) << repP50 - capP50 << std::setw(12)
+                  << repP99 - capP99 << std::endl;
+    }
+    std::cout << "(latências em ms; d = replay - captura)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4 || argc > 5)
+    {
+        std::cerr << "Uso: ./udp_auth_replay <captura> <host> <port> [velocidade]"
+                  << std::endl
+                  << "  velocidade: 1 = original (padrão), N = N vezes mais rápido, "
+                     "0 = o mais rápido possível"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const char* host  = argv[2];
+    uint16_t    port  = atoi(argv[3]);
+    double      speed = argc == 5 ? atof(argv[4]) : 1.0;
+
+    if (speed < 0)
+    {
+        std::cerr << "Velocidade inválida" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<CapturedDatagram> datagrams;
+    if (!readCapture(argv[1], datagrams))
+    {
+        std::cerr << "Arquivo de captura inválido: " << argv[1] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Agrupa os datagramas por socket original e pareia cada resposta com a sua
+    // requisição pelo ResponseDemux, como o cliente faz
+    std::map<uint64_t, size_t>      streamIndex;
+    std::vector<ResponseDemux>      capturedDemux;
+    std::vector<ReplayRequest>      requests;
+    std::map<uint16_t, ReplayStats> stats;
+
+    // O demux guarda ponteiros para as requisições: nada de realocação
+    requests.reserve(datagrams.size());
+
+    for (const CapturedDatagram& datagram : datagrams)
+    {
+        uint64_t key =
+            (static_cast<uint64_t>(datagram.record.session) << 16) |
+            datagram.record.channel;
+
+        auto [it, inserted] = streamIndex.try_emplace(key, capturedDemux.size());
+        if (inserted)
+            capturedDemux.emplace_back();
+
+        size_t stream = it->second;
+
+        if (datagram.record.direction == CAPTURE_SENT)
+        {
+            Datagram    request;
+            DemuxStatus status = classifyDatagram(
+                datagram.payload.data(), datagram.payload.size(), request);
+
+            if (status != DEMUX_OK || request.layout->replyTo ||
+                request.layout->type == ERROR_RESPONSE_TYPE)
+            {
+                std::cerr << "Ignorando datagrama enviado inválido ("
+                          << datagram.payload.size() << " bytes)" << std::endl;
+                continue;
+            }
+
+            requests.push_back({ &datagram, stream, request.layout->type, -1 });
+            capturedDemux[stream].track(
+                datagram.payload.data(), datagram.payload.size(), &requests.back());
+        }
+        else
+        {
+            Datagram        reply;
+            InFlightRequest matched;
+
+            if (capturedDemux[stream].dispatch(datagram.payload.data(),
+                                               datagram.payload.size(),
+                                               reply,
+                                               matched) != DEMUX_OK)
+            {
+                continue;
+            }
+
+            auto* request        = static_cast<ReplayRequest*>(matched.context);
+            request->capturedRtt =
+                (datagram.record.timestamp - request->datagram->record.timestamp) / 1e6;
+        }
+    }
+
+    if (requests.empty())
+    {
+        std::cerr << "Nenhuma requisição na captura" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::stable_sort(requests.begin(),
+                     requests.end(),
+                     [](const ReplayRequest& a, const ReplayRequest& b) {
+                         return a.datagram->record.timestamp <
+                                b.datagram->record.timestamp;
+                     });
+
+    for (const ReplayRequest& request : requests)
+    {
+        if (request.capturedRtt >= 0)
+            stats[request.type].captured.push_back(request.capturedRtt);
+    }
+
+    std::vector<ReplayStream>               streams(capturedDemux.size());
+    std::vector<std::unique_ptr<UdpSocket>> idle;
+    std::vector<struct pollfd>              fds;
+    std::vector<size_t>                     fdStream;
+
+    const uint64_t          first    = requests.front().datagram->record.timestamp;
+    const Clock::time_point start    = Clock::now();
+    const auto              timeout  = std::chrono::seconds(DEFAULT_TIMEOUT);
+    size_t                  next     = 0;
+    size_t                  inFlight = 0;
+    static char             buffer[MAX_DATAGRAM];
+
+    // Velocidade 0 envia tudo imediatamente
+    auto scheduledAt = [&](const ReplayRequest& request) {
+        if (speed == 0)
+            return start;
+
+        return start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::nanoseconds(static_cast<int64_t>(
+                               (request.datagram->record.timestamp - first) / speed)));
+    };
+
+    while (next < requests.size() || inFlight > 0)
+    {
+        Clock::time_point now = Clock::now();
+
+        // Envia tudo que já está agendado
+        while (next < requests.size())
+        {
+            ReplayRequest& request = requests[next];
+
+            if (scheduledAt(request) > now)
+                break;
+
+            ReplayStream& stream = streams[request.stream];
+            if (!stream.socket)
+            {
+                if (!idle.empty())
+                {
+                    stream.socket = std::move(idle.back());
+                    idle.pop_back();
+                }
+                else
+                {
+                    stream.socket = std::make_unique<UdpSocket>(host, port);
+                }
+            }
+
+            // Como na captura, o instante de envio é tomado antes do sendto
+            const std::vector<char>& payload = request.datagram->payload;
+            stream.demux.track(payload.data(), payload.size(), &request);
+            request.sentAt = Clock::now();
+
+            if (stream.socket->send(payload.data(), payload.size()) < 0)
+            {
+                perror("Erro ao enviar mensagem");
+                exit(EXIT_FAILURE);
+            }
+
+            stream.sent.push_back(&request);
+            stream.pending++;
+            stats[request.type].sent++;
+            inFlight++;
+            next++;
+        }
+
+        // Descarta requisições sem resposta dentro do timeout. O socket não volta
+        // para o pool, pois um erro atrasado seria atribuído à requisição errada
+        for (ReplayStream& stream : streams)
+        {
+            ReplayRequest* oldest = stream.oldest();
+
+            if (!oldest || now - oldest->sentAt < timeout)
+                continue;
+
+            for (ReplayRequest* request : stream.sent)
+            {
+                if (!request->answered)
+                    stats[request->type].lost++;
+            }
+
+            inFlight -= stream.pending;
+            stream.pending = 0;
+            stream.sent.clear();
+            stream.demux = ResponseDemux();
+            stream.socket.reset();
+        }
+
+        fds.clear();
+        fdStream.clear();
+        for (size_t i = 0; i < streams.size(); ++i)
+        {
+            if (streams[i].pending > 0)
+            {
+                fds.push_back({ streams[i].socket->fd(), POLLIN, 0 });
+                fdStream.push_back(i);
+            }
+        }
+
+        int waitMs = 100;
+        if (next < requests.size())
+        {
+            auto until = std::chrono::duration_cast<std::chrono::milliseconds>(
+                scheduledAt(requests[next]) - Clock::now());
+            waitMs = std::clamp<int>(until.count(), 0, waitMs);
+        }
+
+        if (poll(fds.data(), fds.size(), waitMs) <= 0)
+            continue;
+
+        for (size_t i = 0; i < fds.size(); ++i)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            ReplayStream&     stream   = streams[fdStream[i]];
+            ssize_t           recv_len = stream.socket->receive(buffer, sizeof(buffer));
+            Clock::time_point received = Clock::now();
+
+            if (recv_len < 0 || !stream.pending)
+                continue;
+
+            Datagram        reply;
+            InFlightRequest matched;
+            DemuxStatus     status =
+                stream.demux.dispatch(buffer, recv_len, reply, matched);
+
+            // Resposta repetida (retransmissão ou cópia de hedge na captura)
+            if (status == DEMUX_UNMATCHED)
+                continue;
+
+            // Datagrama inválido não diz a que requisição responde: vai para a mais
+            // antiga, como um ErrorResponse
+            auto* request = status == DEMUX_OK
+                                ? static_cast<ReplayRequest*>(matched.context)
+                                : stream.oldest();
+
+            if (request->answered)
+                continue;
+
+            request->answered = true;
+            stream.pending--;
+            inFlight--;
+
+            ReplayStats& s = stats[request->type];
+            s.replayed.push_back(elapsedMs(request->sentAt, received));
+
+            if (status != DEMUX_OK || reply.layout->type == ERROR_RESPONSE_TYPE)
+                s.errors++;
+
+            if (!stream.pending)
+            {
+                stream.sent.clear();
+                stream.demux = ResponseDemux();
+                idle.push_back(std::move(stream.socket));
+            }
+        }
+    }
+
+    printReport(stats);
+    std::cout << "Duração total: " << elapsedMs(start, Clock::now()) << " ms"
+              << std::endl;
+
+    return EXIT_SUCCESS;
+}